@@ -0,0 +1,294 @@
+#include "assetPack.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "imageDecoder.h"
+
+namespace {
+
+const int kMinMatch = 4;
+const int kHashBits = 16;
+const size_t kMaxOffset = 65535;
+
+std::unique_ptr<AssetPack> g_mountedPack;
+std::string g_mountedRoot;
+
+inline uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+void writeLength(std::vector<unsigned char> &dst, size_t length)
+{
+    while (length >= 255) {
+        dst.push_back(255);
+        length -= 255;
+    }
+    dst.push_back(static_cast<unsigned char>(length));
+}
+
+bool readLength(const unsigned char *&p, const unsigned char *end, size_t &length)
+{
+    unsigned char b;
+    do {
+        if (p >= end)
+            return false;
+        b = *p++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+} // namespace
+
+uint64_t hashAssetName(const std::string &name)
+{
+    uint64_t h = 14695981039346656037ull; // FNV-1a
+    for (char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h != 0 ? h : 1;
+}
+
+bool compressLz4(const unsigned char *src, size_t size, std::vector<unsigned char> &dst)
+{
+    dst.clear();
+    dst.reserve(size);
+    std::vector<uint32_t> table(size_t(1) << kHashBits, 0xffffffffu);
+    size_t anchor = 0, i = 0;
+    // the last bytes are always literals, as in the LZ4 format
+    const size_t matchLimit = size > 12 ? size - 12 : 0;
+    while (i < matchLimit) {
+        const uint32_t h = (read32(src + i) * 2654435761u) >> (32 - kHashBits);
+        const uint32_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(i);
+        if (candidate == 0xffffffffu || i - candidate > kMaxOffset || read32(src + candidate) != read32(src + i)) {
+            i++;
+            continue;
+        }
+        size_t matchLength = kMinMatch;
+        while (i + matchLength < size - 5 && src[candidate + matchLength] == src[i + matchLength])
+            matchLength++;
+
+        const size_t literals = i - anchor;
+        const size_t extraMatch = matchLength - kMinMatch;
+        dst.push_back(static_cast<unsigned char>((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(extraMatch, 15)));
+        if (literals >= 15)
+            writeLength(dst, literals - 15);
+        dst.insert(dst.end(), src + anchor, src + i);
+        const size_t offset = i - candidate;
+        dst.push_back(static_cast<unsigned char>(offset & 0xff));
+        dst.push_back(static_cast<unsigned char>(offset >> 8));
+        if (extraMatch >= 15)
+            writeLength(dst, extraMatch - 15);
+        i += matchLength;
+        anchor = i;
+        if (dst.size() >= size)
+            return false;
+    }
+    const size_t literals = size - anchor;
+    dst.push_back(static_cast<unsigned char>(std::min<size_t>(literals, 15) << 4));
+    if (literals >= 15)
+        writeLength(dst, literals - 15);
+    dst.insert(dst.end(), src + anchor, src + size);
+    return dst.size() < size;
+}
+
+bool decompressLz4(const unsigned char *src, size_t size, unsigned char *dst, size_t dstSize)
+{
+    const unsigned char *p = src, *end = src + size;
+    size_t out = 0;
+    while (p < end) {
+        const unsigned char token = *p++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(p, end, literals))
+            return false;
+        if (literals > static_cast<size_t>(end - p) || literals > dstSize - out)
+            return false;
+        std::memcpy(dst + out, p, literals);
+        p += literals;
+        out += literals;
+        if (p == end)
+            break; // the last sequence has no match
+        if (end - p < 2)
+            return false;
+        const size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(p, end, matchLength))
+            return false;
+        matchLength += kMinMatch;
+        if (offset == 0 || offset > out || matchLength > dstSize - out)
+            return false;
+        for (size_t k = 0; k < matchLength; k++, out++) // may overlap, byte by byte
+            dst[out] = dst[out - offset];
+    }
+    return out == dstSize;
+}
+
+AssetPack::~AssetPack()
+{
+    if (m_map != nullptr)
+        munmap(const_cast<unsigned char *>(m_map), m_mapSize);
+}
+
+bool AssetPack::open(const std::string &filename)
+{
+    const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(AssetPackHeader))
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+    if (map == MAP_FAILED) {
+        std::cerr << "ERROR: could not map the asset pack " << filename << std::endl;
+        return false;
+    }
+    m_map = static_cast<const unsigned char *>(map);
+    m_mapSize = st.st_size;
+    m_header = reinterpret_cast<const AssetPackHeader *>(m_map);
+    // the table must fit in the file; tested without sums or products that could wrap around
+    const bool tableFits = m_header->tableSize <= m_mapSize / sizeof(AssetPackEntry) && m_header->tocOffset <= m_mapSize
+                           && m_header->tableSize * sizeof(AssetPackEntry) <= m_mapSize - m_header->tocOffset;
+    const uint64_t tableBytes = tableFits ? m_header->tableSize * sizeof(AssetPackEntry) : 0;
+    if (std::memcmp(m_header->magic, "TPAK", 4) != 0 || m_header->version != 1 || m_header->tableSize == 0
+        || (m_header->tableSize & (m_header->tableSize - 1)) != 0 || !tableFits) {
+        std::cerr << "ERROR: " << filename << " is not a valid asset pack" << std::endl;
+        m_header = nullptr;
+        return false;
+    }
+    m_table = reinterpret_cast<const AssetPackEntry *>(m_map + m_header->tocOffset);
+    m_names = reinterpret_cast<const char *>(m_map + m_header->tocOffset + tableBytes);
+    m_namesSize = m_mapSize - (m_header->tocOffset + tableBytes);
+    // every name of the table must be a terminated string of the name block
+    uint32_t numEntries = 0;
+    bool valid = m_header->numEntries <= m_header->tableSize;
+    for (uint32_t slot = 0; slot < m_header->tableSize && valid; slot++) {
+        const AssetPackEntry &e = m_table[slot];
+        if (e.nameHash == 0)
+            continue;
+        numEntries++;
+        valid = e.nameOffset < m_namesSize && std::memchr(m_names + e.nameOffset, 0, m_namesSize - e.nameOffset) != nullptr;
+    }
+    if (!valid || numEntries != m_header->numEntries) {
+        std::cerr << "ERROR: " << filename << " has a corrupted table of contents" << std::endl;
+        m_header = nullptr;
+        return false;
+    }
+    std::cout << "asset pack " << filename << ": " << m_header->numEntries << " assets, " << m_mapSize / 1024 << " KB mapped" << std::endl;
+    return true;
+}
+
+const AssetPackEntry *AssetPack::lookup(const std::string &name) const
+{
+    if (m_header == nullptr)
+        return nullptr;
+    const uint64_t hash = hashAssetName(name);
+    const uint32_t mask = m_header->tableSize - 1;
+    uint32_t slot = hash & mask;
+    for (uint32_t probe = 0; probe < m_header->tableSize; probe++, slot = (slot + 1) & mask) { // a full table has no empty slot
+        const AssetPackEntry &e = m_table[slot];
+        if (e.nameHash == 0)
+            return nullptr;
+        if (e.nameHash == hash && name == m_names + e.nameOffset)
+            return &e;
+    }
+    return nullptr;
+}
+
+bool AssetPack::find(const std::string &name, AssetView &view)
+{
+    const AssetPackEntry *entry = lookup(name);
+    if (entry == nullptr)
+        return false;
+    const AssetPackEntry &e = *entry;
+    if (e.offset > m_mapSize || e.storedSize > m_mapSize - e.offset)
+        return false;
+    if (!e.compressed) {
+        if (e.size != e.storedSize)
+            return false;
+        view.data = m_map + e.offset;
+        view.size = e.size;
+        return true;
+    }
+    if (e.size / 255 > e.storedSize) // beyond what LZ4 expands to, a corrupted size
+        return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<unsigned char> &expanded = m_expanded[e.offset];
+    if (expanded.size() != e.size) {
+        expanded.resize(e.size);
+        if (!decompressLz4(m_map + e.offset, e.storedSize, expanded.data(), expanded.size())) {
+            std::cerr << "ERROR: corrupted asset " << name << " in the pack" << std::endl;
+            m_expanded.erase(e.offset);
+            return false;
+        }
+    }
+    view.data = expanded.data();
+    view.size = expanded.size();
+    return true;
+}
+
+void mountAssetPack(std::unique_ptr<AssetPack> pack, const std::string &root)
+{
+    g_mountedPack = std::move(pack);
+    g_mountedRoot = root;
+}
+
+namespace {
+
+bool findMounted(const std::string &path, AssetView &view)
+{
+    if (!g_mountedPack || path.compare(0, g_mountedRoot.size(), g_mountedRoot) != 0)
+        return false;
+    return g_mountedPack->find(path.substr(g_mountedRoot.size()), view);
+}
+
+} // namespace
+
+bool assetExists(const std::string &path)
+{
+    if (g_mountedPack && path.compare(0, g_mountedRoot.size(), g_mountedRoot) == 0
+        && g_mountedPack->contains(path.substr(g_mountedRoot.size())))
+        return true;
+    std::ifstream f(path.c_str());
+    return f.good();
+}
+
+bool loadAsset(const std::string &path, AssetView &view, std::vector<unsigned char> &storage)
+{
+    if (findMounted(path, view))
+        return true;
+    if (!readBinaryFile(path, storage))
+        return false;
+    view.data = storage.data();
+    view.size = storage.size();
+    return true;
+}
+
+bool loadAssetHead(const std::string &path, size_t maxSize, AssetView &view, std::vector<unsigned char> &storage)
+{
+    if (findMounted(path, view))
+        return true;
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+        return false;
+    storage.resize(maxSize);
+    file.read(reinterpret_cast<char *>(storage.data()), static_cast<std::streamsize>(maxSize));
+    storage.resize(static_cast<size_t>(file.gcount()));
+    view.data = storage.data();
+    view.size = storage.size();
+    return !storage.empty();
+}
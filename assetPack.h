@@ -0,0 +1,87 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Read-only view of the bytes of an asset (C++11 has no std::string_view / std::span).
+struct AssetView {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    inline std::string str() const { return std::string(reinterpret_cast<const char *>(data), size); }
+};
+
+// Single-file archive of the shaders, textures and meshes, memory-mapped at startup so that
+// a cold start pays one open instead of one per asset, and the assets are used in place.
+//
+// Layout: AssetPackHeader, then the entries, each aligned on kAssetPackAlignment bytes, then
+// the table of contents: an open-addressing hash table of AssetPackEntry (linear probing,
+// nameHash 0 marks an empty slot), followed by the zero-terminated entry names.
+// Entries are stored compressed (LZ4 block format) only when it saves space.
+const uint32_t kAssetPackAlignment = 64;
+
+struct AssetPackHeader {
+    char magic[4];        // "TPAK"
+    uint32_t version;     // 1
+    uint32_t numEntries;
+    uint32_t tableSize;   // slots of the hash table, a power of two
+    uint64_t tocOffset;
+};
+
+struct AssetPackEntry {
+    uint64_t nameHash;    // hashAssetName of the name, never 0
+    uint64_t offset;
+    uint64_t storedSize;
+    uint64_t size;        // uncompressed size, equal to storedSize when not compressed
+    uint32_t nameOffset;  // in the name block that follows the table
+    uint32_t compressed;
+};
+
+uint64_t hashAssetName(const std::string &name);
+// LZ4 block format compression, used by the pack builder. Returns false when the input does
+// not compress.
+bool compressLz4(const unsigned char *src, size_t size, std::vector<unsigned char> &dst);
+bool decompressLz4(const unsigned char *src, size_t size, unsigned char *dst, size_t dstSize);
+
+class AssetPack {
+public:
+    ~AssetPack();
+
+    bool open(const std::string &filename);
+    inline size_t size() const { return m_header != nullptr ? m_header->numEntries : 0; }
+    // Finds an asset by name (e.g. "media/earth.jpg"). Uncompressed assets point into the
+    // mapping, compressed ones are expanded once and kept as long as the pack.
+    bool find(const std::string &name, AssetView &view);
+    // Whether the pack has an asset, without expanding it.
+    inline bool contains(const std::string &name) const { return lookup(name) != nullptr; }
+
+private:
+    const AssetPackEntry *lookup(const std::string &name) const;
+
+    const unsigned char *m_map = nullptr;
+    size_t m_mapSize = 0;
+    const AssetPackHeader *m_header = nullptr;
+    const AssetPackEntry *m_table = nullptr;
+    const char *m_names = nullptr;
+    size_t m_namesSize = 0;
+    std::mutex m_mutex;
+    std::map<uint64_t, std::vector<unsigned char>> m_expanded; // by entry offset
+};
+
+// The asset loaders look in the mounted pack first: a path such as "../media/earth.jpg" is
+// looked up as "media/earth.jpg" when the pack was mounted with the root "../".
+void mountAssetPack(std::unique_ptr<AssetPack> pack, const std::string &root);
+bool assetExists(const std::string &path);
+// Gives the content of an asset, from the pack or else from the file, in which case it is
+// read into storage.
+bool loadAsset(const std::string &path, AssetView &view, std::vector<unsigned char> &storage);
+// Same, but reads at most maxSize bytes of a file, e.g. to parse a header. An asset of the
+// pack is given whole, it is mapped anyway.
+bool loadAssetHead(const std::string &path, size_t maxSize, AssetView &view, std::vector<unsigned char> &storage);
+
+#endif // ASSET_PACK_H
@@ -0,0 +1,106 @@
+#include "assetResolver.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "assetPack.h"
+#include "imageDecoder.h"
+
+namespace {
+
+const char *kTierPrefixes[kNumTextureTiers] = {"low_", "", "8k_"};
+const char *kTierNames[kNumTextureTiers] = {"low", "medium", "8k"};
+const char *kExtensions[] = {".jpg", ".png"};
+
+// Rough single core decoding throughput, in megapixels per second
+const double kDecodeMegapixelsPerSecond = 35.0;
+// Enough of a file for its header: the JPEG tables, even after an EXIF block, come before the scan
+const size_t kHeaderBytes = 64 * 1024;
+
+// Size in bytes of the full mip chain of the image, and its pixel count
+bool estimateCost(const std::string &path, size_t &bytes, double &megapixels)
+{
+    std::vector<unsigned char> storage;
+    AssetView data;
+    ImageInfo info;
+    if (!loadAssetHead(path, kHeaderBytes, data, storage) || findImageDecoder(data.data, data.size, info) == nullptr)
+        return false;
+    const double pixels = static_cast<double>(info.width) * info.height;
+    bytes = static_cast<size_t>(pixels * 4 * 4 / 3); // RGBA8 in VRAM, + 1/3 for the mips
+    megapixels = pixels * 1e-6;
+    return true;
+}
+
+} // namespace
+
+const char *tierName(TextureTier tier)
+{
+    return kTierNames[static_cast<int>(tier)];
+}
+
+bool parseTier(const std::string &name, TextureTier &tier)
+{
+    for (int i = 0; i < kNumTextureTiers; i++) {
+        if (name == kTierNames[i]) {
+            tier = static_cast<TextureTier>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string AssetResolver::pathFor(const std::string &name, TextureTier tier) const
+{
+    const std::string base = m_mediaDir + kTierPrefixes[static_cast<int>(tier)] + name;
+    for (const char *ext : kExtensions) {
+        if (assetExists(base + ext))
+            return base + ext;
+    }
+    return base + kExtensions[0];
+}
+
+bool AssetResolver::resolve(const std::string &name, TextureTier tier, std::string &path, TextureTier &found) const
+{
+    std::vector<int> order;
+    for (int t = static_cast<int>(tier); t >= 0; t--)
+        order.push_back(t);
+    for (int t = static_cast<int>(tier) + 1; t < kNumTextureTiers; t++)
+        order.push_back(t);
+    for (int t : order) {
+        const std::string candidate = pathFor(name, static_cast<TextureTier>(t));
+        if (assetExists(candidate)) {
+            path = candidate;
+            found = static_cast<TextureTier>(t);
+            return true;
+        }
+    }
+    return false;
+}
+
+TextureTier AssetResolver::selectTier(const std::vector<std::string> &names, size_t vramBudget, double startupTargetMs) const
+{
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (int t = kNumTextureTiers - 1; t > 0; t--) {
+        size_t bytes = 0;
+        double megapixels = 0.0;
+        for (const std::string &name : names) {
+            std::string path;
+            TextureTier found;
+            size_t b = 0;
+            double mp = 0.0;
+            if (resolve(name, static_cast<TextureTier>(t), path, found) && estimateCost(path, b, mp)) {
+                bytes += b;
+                megapixels += mp;
+            }
+        }
+        const double decodeMs = 1000.0 * megapixels / (kDecodeMegapixelsPerSecond * cores);
+        if (bytes <= vramBudget && decodeMs <= startupTargetMs) {
+            std::cout << "texture tier " << kTierNames[t] << ": " << bytes / (1024 * 1024) << " MB, ~"
+                      << static_cast<int>(decodeMs) << " ms of decoding on " << cores << " cores" << std::endl;
+            return static_cast<TextureTier>(t);
+        }
+    }
+    return TextureTier::Low;
+}
@@ -0,0 +1,38 @@
+#ifndef ASSET_RESOLVER_H
+#define ASSET_RESOLVER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Quality tiers of the texture assets, from the smallest files to the largest.
+// An asset "earth" is looked up as low_earth.jpg, earth.jpg and 8k_earth.jpg.
+enum class TextureTier { Low = 0, Medium = 1, High8k = 2 };
+const int kNumTextureTiers = 3;
+
+const char *tierName(TextureTier tier);
+bool parseTier(const std::string &name, TextureTier &tier);
+
+// Finds the texture files of named assets in the media directory, picking a quality
+// tier that fits the memory budget and the startup time target, and falling back to
+// the closest existing file when an asset is missing at that tier.
+class AssetResolver {
+public:
+    explicit AssetResolver(const std::string &mediaDir) : m_mediaDir(mediaDir) {}
+
+    // Path of the asset at a tier, whether the file exists or not.
+    std::string pathFor(const std::string &name, TextureTier tier) const;
+
+    // Highest tier whose assets (after fallback) fit both in vramBudget bytes, counting
+    // full mip chains, and in startupTargetMs of decoding on all cores.
+    TextureTier selectTier(const std::vector<std::string> &names, size_t vramBudget, double startupTargetMs) const;
+
+    // Best existing file for an asset: the requested tier, then the lower tiers
+    // (cheaper), then the higher ones. Returns false if there is none at all.
+    bool resolve(const std::string &name, TextureTier tier, std::string &path, TextureTier &found) const;
+
+private:
+    std::string m_mediaDir;
+};
+
+#endif // ASSET_RESOLVER_H
@@ -0,0 +1,422 @@
+#include "atmosphere.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+const float kPi = 3.14159265358979f;
+
+// Table sizes, the shaders read them from the textures
+const int kTransmittanceWidth = 256;  // view zenith
+const int kTransmittanceHeight = 64;  // altitude
+const int kScatteringR = 32;
+const int kScatteringMu = 128;
+const int kScatteringMuS = 32;
+const int kScatteringNu = 8;
+const int kIrradianceWidth = 64;      // sun zenith
+const int kIrradianceHeight = 16;     // altitude
+
+const int kTransmittanceSteps = 500;
+const int kScatteringSteps = 50;
+const int kIrradianceSteps = 32;      // directions per half circle
+
+const uint32_t kCacheVersion = 1;
+
+// Cache file header, followed by the three tables
+struct AtmosphereCacheHeader {
+    char magic[4];                    // "ATM1"
+    uint32_t version;                 // of the precomputation, the cache is stale when it changes
+    AtmosphereParameters params;
+};
+
+// Runs fn(row) for every row in [0, rows) on all cores
+void parallelRows(int rows, const std::function<void(int)> &fn)
+{
+    const int numThreads = static_cast<int>(std::min<unsigned int>(std::max(1u, std::thread::hardware_concurrency()), rows));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&fn, rows, numThreads, t]() {
+            for (int row = t; row < rows; row += numThreads)
+                fn(row);
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+inline float clampf(float x, float lo, float hi) { return std::min(std::max(x, lo), hi); }
+
+// Whether the ray from radius r with view zenith cosine mu hits the ground
+bool hitsGround(const AtmosphereParameters &p, float r, float mu)
+{
+    return mu < 0.f && r * r * (mu * mu - 1.f) + p.groundRadius * p.groundRadius >= 0.f;
+}
+
+// Length of the ray inside the atmosphere, up to the ground when it hits it
+float rayLength(const AtmosphereParameters &p, float r, float mu)
+{
+    if (hitsGround(p, r, mu))
+        return std::max(-r * mu - std::sqrt(r * r * (mu * mu - 1.f) + p.groundRadius * p.groundRadius), 0.f);
+    return std::max(-r * mu + std::sqrt(std::max(r * r * (mu * mu - 1.f) + p.topRadius * p.topRadius, 0.f)), 0.f);
+}
+
+// Bilinear lookup of a table of width x height texels, uv in [0, 1] as for texture() with GL_CLAMP_TO_EDGE
+void sample2D(const float *table, int width, int height, int channels, float u, float v, float *out)
+{
+    const float x = clampf(u * width - 0.5f, 0.f, width - 1.f), y = clampf(v * height - 0.5f, 0.f, height - 1.f);
+    const int x0 = static_cast<int>(x), y0 = static_cast<int>(y);
+    const int x1 = std::min(x0 + 1, width - 1), y1 = std::min(y0 + 1, height - 1);
+    const float fx = x - x0, fy = y - y0;
+    for (int c = 0; c < channels; c++) {
+        const float top = table[(y0 * width + x0) * channels + c] * (1 - fx) + table[(y0 * width + x1) * channels + c] * fx;
+        const float bottom = table[(y1 * width + x0) * channels + c] * (1 - fx) + table[(y1 * width + x1) * channels + c] * fx;
+        out[c] = top * (1 - fy) + bottom * fy;
+    }
+}
+
+// Trilinear lookup of an RGBA table, uvw in [0, 1]
+void sample3D(const std::vector<float> &table, int width, int height, int depth, float u, float v, float w, float out[4])
+{
+    const size_t slice = static_cast<size_t>(width) * height * 4;
+    const float z = clampf(w * depth - 0.5f, 0.f, depth - 1.f);
+    const int z0 = static_cast<int>(z), z1 = std::min(z0 + 1, depth - 1);
+    const float fz = z - z0;
+    float a[4], b[4];
+    sample2D(table.data() + z0 * slice, width, height, 4, u, v, a);
+    sample2D(table.data() + z1 * slice, width, height, 4, u, v, b);
+    for (int c = 0; c < 4; c++)
+        out[c] = a[c] * (1 - fz) + b[c] * fz;
+}
+
+// Table parameterizations, the same as in fragmentShader.glsl
+
+void transmittance(const AtmosphereParameters &p, const std::vector<float> &table, float r, float mu, float out[3])
+{
+    const float uR = std::sqrt(std::max(r - p.groundRadius, 0.f) / (p.topRadius - p.groundRadius));
+    const float uMu = std::atan((mu + 0.15f) / 1.15f * std::tan(1.5f)) / 1.5f;
+    sample2D(table.data(), kTransmittanceWidth, kTransmittanceHeight, 3, uMu, uR, out);
+}
+
+void scattering(const AtmosphereParameters &p, const std::vector<float> &table, float r, float mu, float muS, float nu, float out[4])
+{
+    const float Rg = p.groundRadius, Rt = p.topRadius;
+    r = clampf(r, Rg + 0.05f, Rt);
+    const float H = std::sqrt(Rt * Rt - Rg * Rg);
+    const float rho = std::sqrt(r * r - Rg * Rg);
+    const float rmu = r * mu;
+    const float delta = rmu * rmu - r * r + Rg * Rg;
+    // the rays hitting the ground use the first half of the mu axis, the others the second half
+    float uMu;
+    if (rmu < 0.f && delta > 0.f)
+        uMu = 0.5f - 0.5f / kScatteringMu + (rmu + std::sqrt(delta)) / rho * (0.5f - 1.f / kScatteringMu);
+    else
+        uMu = 0.5f + 0.5f / kScatteringMu + (-rmu + std::sqrt(std::max(delta + H * H, 0.f))) / (rho + H) * (0.5f - 1.f / kScatteringMu);
+    const float uR = 0.5f / kScatteringR + rho / H * (1.f - 1.f / kScatteringR);
+    const float uMuS = 0.5f / kScatteringMuS
+        + (std::atan(std::max(muS, -0.1975f) * std::tan(1.26f * 1.1f)) / 1.1f + (1.f - 0.26f)) * 0.5f * (1.f - 1.f / kScatteringMuS);
+    float lerp = (nu + 1.f) / 2.f * (kScatteringNu - 1);
+    const float uNu = std::floor(lerp);
+    lerp -= uNu;
+    float a[4], b[4];
+    const int width = kScatteringMuS * kScatteringNu;
+    sample3D(table, width, kScatteringMu, kScatteringR, (uNu + uMuS) / kScatteringNu, uMu, uR, a);
+    sample3D(table, width, kScatteringMu, kScatteringR, (uNu + uMuS + 1.f) / kScatteringNu, uMu, uR, b);
+    for (int c = 0; c < 4; c++)
+        out[c] = a[c] * (1 - lerp) + b[c] * lerp;
+}
+
+float phaseRayleigh(float nu)
+{
+    return 3.f / (16.f * kPi) * (1.f + nu * nu);
+}
+
+float phaseMie(float g, float nu)
+{
+    return 1.5f / (4.f * kPi) * (1.f - g * g) * std::pow(1.f + g * g - 2.f * g * nu, -1.5f) * (1.f + nu * nu) / (2.f + g * g);
+}
+
+// Transmittance to the top of the atmosphere, zero when the ray hits the ground
+void computeTransmittance(const AtmosphereParameters &p, int y, std::vector<float> &table)
+{
+    const float uR = (y + 0.5f) / kTransmittanceHeight;
+    const float r = p.groundRadius + uR * uR * (p.topRadius - p.groundRadius);
+    for (int x = 0; x < kTransmittanceWidth; x++) {
+        const float uMu = (x + 0.5f) / kTransmittanceWidth;
+        const float mu = -0.15f + std::tan(1.5f * uMu) / std::tan(1.5f) * 1.15f;
+        float depthR = 1e9f, depthM = 1e9f;
+        if (!hitsGround(p, r, mu)) {
+            // trapezoidal integration of the densities along the ray
+            const float dx = rayLength(p, r, mu) / kTransmittanceSteps;
+            float prevR = std::exp(-(r - p.groundRadius) / p.rayleighHeight);
+            float prevM = std::exp(-(r - p.groundRadius) / p.mieHeight);
+            depthR = depthM = 0.f;
+            for (int i = 1; i <= kTransmittanceSteps; i++) {
+                const float t = i * dx;
+                const float ri = std::sqrt(r * r + t * t + 2.f * r * mu * t);
+                const float densityR = std::exp(-(ri - p.groundRadius) / p.rayleighHeight);
+                const float densityM = std::exp(-(ri - p.groundRadius) / p.mieHeight);
+                depthR += (prevR + densityR) * 0.5f * dx;
+                depthM += (prevM + densityM) * 0.5f * dx;
+                prevR = densityR;
+                prevM = densityM;
+            }
+        }
+        for (int c = 0; c < 3; c++)
+            table[(y * kTransmittanceWidth + x) * 3 + c] = std::exp(-(p.rayleighScattering[c] * depthR + p.mieExtinction * depthM));
+    }
+}
+
+// Sunlight scattered once towards a point at radius r, integrated along the view ray
+void integrateScattering(const AtmosphereParameters &p, const std::vector<float> &transmittanceTable,
+                         float r, float mu, float muS, float nu, float rayleigh[3], float mie[3])
+{
+    const float dx = rayLength(p, r, mu) / kScatteringSteps;
+    float depthR = 0.f, depthM = 0.f, prevR = 0.f, prevM = 0.f;
+    for (int c = 0; c < 3; c++)
+        rayleigh[c] = mie[c] = 0.f;
+    for (int i = 0; i <= kScatteringSteps; i++) {
+        const float t = i * dx;
+        const float ri = std::max(std::sqrt(r * r + t * t + 2.f * r * mu * t), p.groundRadius);
+        const float densityR = std::exp(-(ri - p.groundRadius) / p.rayleighHeight);
+        const float densityM = std::exp(-(ri - p.groundRadius) / p.mieHeight);
+        if (i > 0) {
+            depthR += (prevR + densityR) * 0.5f * dx;
+            depthM += (prevM + densityM) * 0.5f * dx;
+        }
+        prevR = densityR;
+        prevM = densityM;
+        // sun direction seen from the sample point, no sunlight when the ground is in the way
+        const float muSi = clampf((nu * t + muS * r) / ri, -1.f, 1.f);
+        if (hitsGround(p, ri, muSi))
+            continue;
+        float sun[3];
+        transmittance(p, transmittanceTable, ri, muSi, sun);
+        const float weight = (i == 0 || i == kScatteringSteps) ? 0.5f * dx : dx;
+        for (int c = 0; c < 3; c++) {
+            const float light = sun[c] * std::exp(-(p.rayleighScattering[c] * depthR + p.mieExtinction * depthM)) * weight;
+            rayleigh[c] += densityR * light;
+            mie[c] += densityM * light;
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        rayleigh[c] *= p.rayleighScattering[c];
+        mie[c] *= p.mieScattering;
+    }
+}
+
+void computeScattering(const AtmosphereParameters &p, const std::vector<float> &transmittanceTable, int layer, std::vector<float> &table)
+{
+    const float Rg = p.groundRadius, Rt = p.topRadius;
+    // altitude of the layer, kept off the exact ground and top
+    float r = static_cast<float>(layer) / (kScatteringR - 1);
+    r = std::sqrt(Rg * Rg + r * r * (Rt * Rt - Rg * Rg)) + (layer == 0 ? 0.01f : (layer == kScatteringR - 1 ? -0.001f : 0.f));
+    r = std::min(r, Rt);
+    const float H = std::sqrt(Rt * Rt - Rg * Rg);
+    const float rho = std::sqrt(r * r - Rg * Rg);
+    const float dMin = Rt - r, dMax = rho + H;      // distances to the top
+    const float dMinGround = r - Rg, dMaxGround = rho;
+    const int width = kScatteringMuS * kScatteringNu;
+    for (int y = 0; y < kScatteringMu; y++) {
+        float mu;
+        if (y < kScatteringMu / 2) {
+            float d = 1.f - static_cast<float>(y) / (kScatteringMu / 2 - 1);
+            d = std::min(std::max(dMinGround, d * dMaxGround), dMaxGround * 0.999f);
+            mu = (Rg * Rg - r * r - d * d) / (2.f * r * d);
+            mu = std::min(mu, -std::sqrt(1.f - (Rg / r) * (Rg / r)) - 0.001f);
+        } else {
+            float d = static_cast<float>(y - kScatteringMu / 2) / (kScatteringMu / 2 - 1);
+            d = std::min(std::max(dMin, d * dMax), dMax * 0.999f);
+            mu = (Rt * Rt - r * r - d * d) / (2.f * r * d);
+        }
+        mu = clampf(mu, -1.f, 1.f);
+        for (int x = 0; x < width; x++) {
+            float muS = static_cast<float>(x % kScatteringMuS) / (kScatteringMuS - 1);
+            muS = std::tan((2.f * muS - 1.f + 0.26f) * 1.1f) / std::tan(1.26f * 1.1f);
+            float nu = -1.f + static_cast<float>(x / kScatteringMuS) / (kScatteringNu - 1) * 2.f;
+            // only the angles possible between the view and the sun directions
+            const float spread = std::sqrt(std::max((1.f - mu * mu) * (1.f - muS * muS), 0.f));
+            nu = clampf(nu, muS * mu - spread, muS * mu + spread);
+            float rayleigh[3], mie[3];
+            integrateScattering(p, transmittanceTable, r, mu, muS, nu, rayleigh, mie);
+            float *texel = &table[((static_cast<size_t>(layer) * kScatteringMu + y) * width + x) * 4];
+            texel[0] = rayleigh[0];
+            texel[1] = rayleigh[1];
+            texel[2] = rayleigh[2];
+            texel[3] = mie[0];
+        }
+    }
+}
+
+// Light of the sky reaching a horizontal ground (or a point at altitude), over the hemisphere
+void computeIrradiance(const AtmosphereParameters &p, const std::vector<float> &scatteringTable, int y, std::vector<float> &table)
+{
+    const float r = p.groundRadius + static_cast<float>(y) / (kIrradianceHeight - 1) * (p.topRadius - p.groundRadius);
+    const float dAngle = kPi / kIrradianceSteps;
+    for (int x = 0; x < kIrradianceWidth; x++) {
+        const float muS = -0.2f + static_cast<float>(x) / (kIrradianceWidth - 1) * 1.2f;
+        const float s[3] = {std::sqrt(std::max(1.f - muS * muS, 0.f)), 0.f, muS};
+        float sum[3] = {0.f, 0.f, 0.f};
+        for (int i = 0; i < 2 * kIrradianceSteps; i++) {
+            const float phi = (i + 0.5f) * dAngle;
+            for (int j = 0; j < kIrradianceSteps / 2; j++) {
+                const float theta = (j + 0.5f) * dAngle;
+                const float w[3] = {std::cos(phi) * std::sin(theta), std::sin(phi) * std::sin(theta), std::cos(theta)};
+                const float nu = s[0] * w[0] + s[1] * w[1] + s[2] * w[2];
+                float texel[4];
+                scattering(p, scatteringTable, r, w[2], muS, nu, texel);
+                const float weight = w[2] * std::sin(theta) * dAngle * dAngle;
+                for (int c = 0; c < 3; c++) {
+                    // Mie RGB from its red and the Rayleigh ratios, see scatteredLight in the shader
+                    const float mie = texel[0] * texel[3] / std::max(texel[0], 1e-4f) * p.rayleighScattering[0] / p.rayleighScattering[c];
+                    sum[c] += (texel[c] * phaseRayleigh(nu) + mie * phaseMie(p.mieG, nu)) * weight;
+                }
+            }
+        }
+        for (int c = 0; c < 3; c++)
+            table[(y * kIrradianceWidth + x) * 3 + c] = sum[c];
+    }
+}
+
+GLuint createTexture(GLenum target)
+{
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(target, tex);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    return tex;
+}
+
+} // namespace
+
+void AtmosphereParameters::exaggerate(float factor)
+{
+    topRadius = groundRadius + (topRadius - groundRadius) * factor;
+    rayleighHeight *= factor;
+    mieHeight *= factor;
+    for (int c = 0; c < 3; c++)
+        rayleighScattering[c] /= factor;
+    mieScattering /= factor;
+    mieExtinction /= factor;
+}
+
+void Atmosphere::clear()
+{
+    if (m_textures[0] != 0)
+        glDeleteTextures(3, m_textures);
+    m_textures[0] = m_textures[1] = m_textures[2] = 0;
+}
+
+bool Atmosphere::init(const AtmosphereParameters &params, const std::string &cacheFile)
+{
+    m_params = params;
+    if (!readCache(cacheFile)) {
+        const auto start = std::chrono::steady_clock::now();
+        precompute();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "atmosphere tables computed in " << static_cast<int>(ms) << " ms" << std::endl;
+        writeCache(cacheFile);
+    }
+    upload();
+    return true;
+}
+
+void Atmosphere::precompute()
+{
+    const AtmosphereParameters &p = m_params;
+    m_transmittance.assign(static_cast<size_t>(kTransmittanceWidth) * kTransmittanceHeight * 3, 0.f);
+    m_scattering.assign(static_cast<size_t>(kScatteringMuS) * kScatteringNu * kScatteringMu * kScatteringR * 4, 0.f);
+    m_irradiance.assign(static_cast<size_t>(kIrradianceWidth) * kIrradianceHeight * 3, 0.f);
+    // each table reads the previous one
+    parallelRows(kTransmittanceHeight, [this, &p](int y) { computeTransmittance(p, y, m_transmittance); });
+    parallelRows(kScatteringR, [this, &p](int layer) { computeScattering(p, m_transmittance, layer, m_scattering); });
+    parallelRows(kIrradianceHeight, [this, &p](int y) { computeIrradiance(p, m_scattering, y, m_irradiance); });
+}
+
+bool Atmosphere::readCache(const std::string &cacheFile)
+{
+    std::ifstream file(cacheFile.c_str(), std::ios::binary);
+    AtmosphereCacheHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+    if (std::memcmp(header.magic, "ATM1", 4) != 0 || header.version != kCacheVersion
+        || std::memcmp(&header.params, &m_params, sizeof(m_params)) != 0)
+        return false;
+    m_transmittance.resize(static_cast<size_t>(kTransmittanceWidth) * kTransmittanceHeight * 3);
+    m_scattering.resize(static_cast<size_t>(kScatteringMuS) * kScatteringNu * kScatteringMu * kScatteringR * 4);
+    m_irradiance.resize(static_cast<size_t>(kIrradianceWidth) * kIrradianceHeight * 3);
+    for (std::vector<float> *table : {&m_transmittance, &m_scattering, &m_irradiance}) {
+        if (!file.read(reinterpret_cast<char *>(table->data()), table->size() * sizeof(float)))
+            return false;
+    }
+    return true;
+}
+
+void Atmosphere::writeCache(const std::string &cacheFile) const
+{
+    // written aside and renamed, so that an interrupted write never leaves a truncated cache
+    const std::string tmpPath = cacheFile + ".tmp";
+    {
+        std::ofstream file(tmpPath.c_str(), std::ios::binary);
+        AtmosphereCacheHeader header;
+        std::memcpy(header.magic, "ATM1", 4);
+        header.version = kCacheVersion;
+        header.params = m_params;
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (const std::vector<float> *table : {&m_transmittance, &m_scattering, &m_irradiance})
+            file.write(reinterpret_cast<const char *>(table->data()), table->size() * sizeof(float));
+        if (!file) {
+            std::cerr << "WARNING: could not write the atmosphere cache " << cacheFile << std::endl;
+            std::remove(tmpPath.c_str());
+            return;
+        }
+    }
+    std::rename(tmpPath.c_str(), cacheFile.c_str());
+}
+
+void Atmosphere::upload()
+{
+    // half floats are precise enough, and filterable everywhere
+    m_textures[0] = createTexture(GL_TEXTURE_2D);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, kTransmittanceWidth, kTransmittanceHeight, 0, GL_RGB, GL_FLOAT, m_transmittance.data());
+    m_textures[1] = createTexture(GL_TEXTURE_3D);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, kScatteringMuS * kScatteringNu, kScatteringMu, kScatteringR, 0, GL_RGBA, GL_FLOAT,
+                 m_scattering.data());
+    m_textures[2] = createTexture(GL_TEXTURE_2D);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, kIrradianceWidth, kIrradianceHeight, 0, GL_RGB, GL_FLOAT, m_irradiance.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    // the GPU has its copy
+    std::vector<float>().swap(m_transmittance);
+    std::vector<float>().swap(m_scattering);
+    std::vector<float>().swap(m_irradiance);
+}
+
+void Atmosphere::bind(GLuint program, int firstUnit, float planetRadius) const
+{
+    const char *samplers[3] = {"transmittanceLut", "scatteringLut", "irradianceLut"};
+    const GLenum targets[3] = {GL_TEXTURE_2D, GL_TEXTURE_3D, GL_TEXTURE_2D};
+    for (int i = 0; i < 3; i++) {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(targets[i], m_textures[i]);
+        glUniform1i(glGetUniformLocation(program, samplers[i]), firstUnit + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(program, "scatteringNuSize"), kScatteringNu);
+    glUniform2f(glGetUniformLocation(program, "atmosphereRadii"), m_params.groundRadius, m_params.topRadius);
+    glUniform3fv(glGetUniformLocation(program, "rayleighScattering"), 1, m_params.rayleighScattering);
+    glUniform1f(glGetUniformLocation(program, "mieG"), m_params.mieG);
+    glUniform1f(glGetUniformLocation(program, "kmPerUnit"), m_params.groundRadius / planetRadius);
+}
@@ -0,0 +1,62 @@
+#ifndef ATMOSPHERE_H
+#define ATMOSPHERE_H
+
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Physical model of the atmosphere: Rayleigh (air) and Mie (aerosols) scattering, both with
+// a density decreasing exponentially with the altitude. Lengths are in km.
+struct AtmosphereParameters {
+    float groundRadius = 6360.f;
+    float topRadius = 6420.f;
+    float rayleighScattering[3] = {5.8e-3f, 1.35e-2f, 3.31e-2f}; // per km, at sea level
+    float rayleighHeight = 8.f;                                   // scale height
+    float mieScattering = 4e-3f;
+    float mieExtinction = 4e-3f / 0.9f;
+    float mieHeight = 1.2f;
+    float mieG = 0.8f;                                            // phase function asymmetry
+
+    // Makes the atmosphere factor times thicker with the same vertical optical depth, so
+    // that it stays visible around a planet of the size it has in the scene.
+    void exaggerate(float factor);
+};
+
+// Precomputed atmospheric scattering (Bruneton and Neyret 2008), single scattering:
+// - transmittance of the air from a point to the top of the atmosphere, by (altitude, view zenith)
+// - light scattered towards a point, by (altitude, view zenith, sun zenith, view-sun angle),
+//   the 4D table being packed in a 3D texture, Rayleigh in RGB and the red of Mie in alpha
+// - sky light reaching the ground, by (altitude, sun zenith)
+// With them, the atmosphere seen along any ray costs a few texture fetches in the fragment
+// shader (ATMOSPHERE and ATMOSPHERE_SHELL permutations) instead of a ray march.
+// The tables are computed on all cores the first time and cached on disk.
+class Atmosphere {
+public:
+    // Loads the tables from the cache file, or computes them and writes the cache.
+    bool init(const AtmosphereParameters &params, const std::string &cacheFile);
+    inline const AtmosphereParameters &getParameters() const { return m_params; }
+    inline bool isReady() const { return m_textures[0] != 0; }
+    // Radius, in scene units, of the shell containing the atmosphere of a planet
+    inline float shellRadius(float planetRadius) const { return planetRadius * m_params.topRadius / m_params.groundRadius; }
+
+    // Binds the three tables on units firstUnit..firstUnit+2 and sets the atmosphere uniforms
+    // for a planet of planetRadius scene units.
+    void bind(GLuint program, int firstUnit, float planetRadius) const;
+    // Deletes the textures, while the context is current.
+    void clear();
+
+private:
+    void precompute();
+    bool readCache(const std::string &cacheFile);
+    void writeCache(const std::string &cacheFile) const;
+    void upload();
+
+    AtmosphereParameters m_params;
+    std::vector<float> m_transmittance; // RGB
+    std::vector<float> m_scattering;    // RGBA
+    std::vector<float> m_irradiance;    // RGB
+    GLuint m_textures[3] = {0, 0, 0};
+};
+
+#endif // ATMOSPHERE_H
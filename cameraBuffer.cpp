@@ -0,0 +1,77 @@
+#include "cameraBuffer.h"
+
+#include <cstring>
+
+#include "glExtensions.h"
+
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock must match the std140 layout of the Camera block");
+
+bool CameraBuffer::init(bool persistent)
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    m_stride = (static_cast<GLsizeiptr>(sizeof(CameraBlock)) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    if (persistent && glBufferStorage != nullptr) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, m_stride * kNumSlots, nullptr, flags);
+        m_mapped = static_cast<unsigned char *>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, m_stride * kNumSlots, flags));
+    }
+    else {
+        glBufferData(GL_UNIFORM_BUFFER, m_stride * kNumSlots, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return isPersistent();
+}
+
+void CameraBuffer::beginFrame()
+{
+    m_slot = (m_slot + 1) % kNumSlots;
+    GLsync &fence = m_fences[m_slot];
+    if (fence != nullptr) {
+        // kNumSlots frames ago, normally long done
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, kBinding, m_buffer, m_stride * m_slot, sizeof(CameraBlock));
+}
+
+void CameraBuffer::write(const CameraBlock &block)
+{
+    if (m_mapped != nullptr) {
+        std::memcpy(m_mapped + m_stride * m_slot, &block, sizeof(CameraBlock));
+        return;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, m_stride * m_slot, sizeof(CameraBlock), &block);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void CameraBuffer::endFrame()
+{
+    m_fences[m_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void CameraBuffer::clear()
+{
+    for (GLsync &fence : m_fences) {
+        if (fence != nullptr)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (m_buffer != 0)
+        glDeleteBuffers(1, &m_buffer); // unmaps a persistent mapping
+    m_buffer = 0;
+    m_mapped = nullptr;
+}
+
+void CameraBuffer::bindProgram(GLuint program)
+{
+    const GLuint index = glGetUniformBlockIndex(program, "Camera");
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, index, kBinding);
+}
@@ -0,0 +1,50 @@
+#ifndef CAMERA_BUFFER_H
+#define CAMERA_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// std140 layout of the Camera uniform block of the shaders
+struct CameraBlock {
+    glm::mat4 viewMat;
+    glm::mat4 projMat;
+    glm::vec4 camPos; // xyz, relative to the origin of the transforms of the frame
+};
+
+// The Camera uniform block, shared by every program and written once per frame instead of per
+// draw, so that it can be written as late as possible from fresh input (late latching). The
+// buffer is a ring of kNumSlots frames guarded by fences. With persistent mapping (GL 4.4 or
+// ARB_buffer_storage), write() goes straight to the memory the GPU reads when it runs the
+// draws, so it can follow their submission: the GL only guarantees the new value to the
+// commands issued after it, in practice the draws the GPU has not started yet see it too.
+// Without it, write() takes effect for the draws submitted after the call.
+class CameraBuffer {
+public:
+    static const GLuint kBinding = 0;
+
+    // Returns whether the buffer is persistently mapped (asked and supported)
+    bool init(bool persistent);
+    inline bool isPersistent() const { return m_mapped != nullptr; }
+
+    // Binds the slot of the frame, waiting for the GPU to be done with it.
+    void beginFrame();
+    void write(const CameraBlock &block);
+    // Fences the slot after the last draw of the frame.
+    void endFrame();
+    // Deletes the buffer and the fences, while the context is current.
+    void clear();
+
+    // Connects the Camera block of a program to kBinding.
+    static void bindProgram(GLuint program);
+
+private:
+    static const int kNumSlots = 3;
+
+    GLuint m_buffer = 0;
+    GLsizeiptr m_stride = 0;              // slot size, rounded up to the offset alignment
+    unsigned char *m_mapped = nullptr;
+    GLsync m_fences[kNumSlots] = {};
+    int m_slot = 0;
+};
+
+#endif // CAMERA_BUFFER_H
@@ -0,0 +1,157 @@
+#include "clusteredLights.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int kNumClusters = ClusteredLights::kClustersX * ClusteredLights::kClustersY * ClusteredLights::kClustersZ;
+
+// Range of depth slices covering view distances [zmin, zmax]
+void sliceRange(float zmin, float zmax, float near, float far, int &first, int &last)
+{
+    const float scale = ClusteredLights::kClustersZ / std::log(far / near);
+    first = static_cast<int>(std::floor(std::log(std::max(zmin, near) / near) * scale));
+    last = static_cast<int>(std::floor(std::log(std::max(zmax, near) / near) * scale));
+    first = std::min(std::max(first, 0), ClusteredLights::kClustersZ - 1);
+    last = std::min(std::max(last, 0), ClusteredLights::kClustersZ - 1);
+}
+
+// Range of tiles covering [ndcMin, ndcMax] along one axis
+void tileRange(float ndcMin, float ndcMax, int tiles, int &first, int &last)
+{
+    first = static_cast<int>(std::floor((ndcMin * 0.5f + 0.5f) * tiles));
+    last = static_cast<int>(std::floor((ndcMax * 0.5f + 0.5f) * tiles));
+    first = std::min(std::max(first, 0), tiles - 1);
+    last = std::min(std::max(last, 0), tiles - 1);
+}
+
+struct LightBounds {
+    uint32_t light;
+    int x0, x1, y0, y1, z0, z1;
+};
+
+} // namespace
+
+void ClusteredLights::init()
+{
+    const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+    glGenBuffers(3, m_buffers);
+    glGenTextures(3, m_textures);
+    for (int i = 0; i < 3; i++) {
+        glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void ClusteredLights::clear()
+{
+    if (m_buffers[0] != 0) {
+        glDeleteTextures(3, m_textures);
+        glDeleteBuffers(3, m_buffers);
+    }
+    for (int i = 0; i < 3; i++)
+        m_buffers[i] = m_textures[i] = 0;
+}
+
+void ClusteredLights::update(const std::vector<PointLight> &lights, const glm::mat4 &viewMatrix, float fovY, float aspectRatio,
+                             float near, float far, int viewportWidth, int viewportHeight)
+{
+    if (m_buffers[0] == 0)
+        init();
+    m_near = near;
+    m_far = far;
+    m_viewportWidth = std::max(1, viewportWidth);
+    m_viewportHeight = std::max(1, viewportHeight);
+    const float tanY = std::tan(glm::radians(fovY) * 0.5f), tanX = tanY * aspectRatio;
+
+    // 1. clusters covered by the bounding box of each light, projected conservatively
+    m_lightData.resize(lights.size() * 8);
+    std::vector<LightBounds> bounds;
+    bounds.reserve(lights.size());
+    for (size_t i = 0; i < lights.size(); i++) {
+        const PointLight &light = lights[i];
+        float *data = &m_lightData[i * 8];
+        data[0] = light.position.x; data[1] = light.position.y; data[2] = light.position.z; data[3] = light.radius;
+        data[4] = light.color.r; data[5] = light.color.g; data[6] = light.color.b; data[7] = 0.f;
+
+        const glm::vec3 p = glm::vec3(viewMatrix * glm::vec4(light.position, 1.f));
+        const float zmin = -p.z - light.radius, zmax = -p.z + light.radius; // view distances
+        if (zmax < near || zmin > far)
+            continue;
+        LightBounds b;
+        b.light = static_cast<uint32_t>(i);
+        sliceRange(zmin, zmax, near, far, b.z0, b.z1);
+        if (zmin <= near) {
+            // reaches the camera plane, its projection is unbounded
+            b.x0 = 0; b.x1 = kClustersX - 1;
+            b.y0 = 0; b.y1 = kClustersY - 1;
+        }
+        else {
+            float ndc[4] = {1e9f, -1e9f, 1e9f, -1e9f}; // x min, x max, y min, y max
+            for (float z : {zmin, zmax}) {
+                for (float s : {-1.f, 1.f}) {
+                    const float x = (p.x + s * light.radius) / (z * tanX), y = (p.y + s * light.radius) / (z * tanY);
+                    ndc[0] = std::min(ndc[0], x); ndc[1] = std::max(ndc[1], x);
+                    ndc[2] = std::min(ndc[2], y); ndc[3] = std::max(ndc[3], y);
+                }
+            }
+            if (ndc[0] > 1.f || ndc[1] < -1.f || ndc[2] > 1.f || ndc[3] < -1.f)
+                continue;
+            tileRange(ndc[0], ndc[1], kClustersX, b.x0, b.x1);
+            tileRange(ndc[2], ndc[3], kClustersY, b.y0, b.y1);
+        }
+        bounds.push_back(b);
+    }
+
+    // 2. per cluster ranges in one index list: counting, prefix sums, then filling
+    m_ranges.assign(kNumClusters * 2, 0);
+    for (const LightBounds &b : bounds)
+        for (int z = b.z0; z <= b.z1; z++)
+            for (int y = b.y0; y <= b.y1; y++)
+                for (int x = b.x0; x <= b.x1; x++)
+                    m_ranges[((z * kClustersY + y) * kClustersX + x) * 2 + 1]++;
+    uint32_t offset = 0;
+    for (int c = 0; c < kNumClusters; c++) {
+        m_ranges[c * 2] = offset;
+        offset += m_ranges[c * 2 + 1];
+        m_ranges[c * 2 + 1] = 0;
+    }
+    m_indices.resize(offset);
+    for (const LightBounds &b : bounds)
+        for (int z = b.z0; z <= b.z1; z++)
+            for (int y = b.y0; y <= b.y1; y++)
+                for (int x = b.x0; x <= b.x1; x++) {
+                    uint32_t *range = &m_ranges[((z * kClustersY + y) * kClustersX + x) * 2];
+                    m_indices[range[0] + range[1]++] = b.light;
+                }
+
+    // 3. upload, orphaning last frame's storage
+    const void *data[3] = {m_lightData.data(), m_ranges.data(), m_indices.data()};
+    const size_t sizes[3] = {m_lightData.size() * sizeof(float), m_ranges.size() * sizeof(uint32_t), m_indices.size() * sizeof(uint32_t)};
+    for (int i = 0; i < 3; i++) {
+        glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(sizes[i], size_t(16)), nullptr, GL_STREAM_DRAW);
+        if (sizes[i] > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void ClusteredLights::bind(GLuint program, int firstUnit) const
+{
+    const char *samplers[3] = {"lightData", "clusterRanges", "lightIndices"};
+    for (int i = 0; i < 3; i++) {
+        glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+        glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+        glUniform1i(glGetUniformLocation(program, samplers[i]), firstUnit + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    glUniform3i(glGetUniformLocation(program, "clusterDims"), kClustersX, kClustersY, kClustersZ);
+    glUniform2f(glGetUniformLocation(program, "clusterDepth"), m_near, kClustersZ / std::log(m_far / m_near));
+    glUniform2f(glGetUniformLocation(program, "viewportSize"), static_cast<float>(m_viewportWidth), static_cast<float>(m_viewportHeight));
+}
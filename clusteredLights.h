@@ -0,0 +1,52 @@
+#ifndef CLUSTERED_LIGHTS_H
+#define CLUSTERED_LIGHTS_H
+
+#include <cstdint>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Small local light source (spacecraft, city, satellite), fading to nothing at radius.
+struct PointLight {
+    glm::vec3 position; // world space
+    float radius;
+    glm::vec3 color;
+};
+
+// Clustered forward shading: the view frustum is cut into a grid of clusters (screen tiles x
+// exponential depth slices), every frame the CPU bins the lights into the clusters they
+// touch, and the fragment shader (CLUSTERED_LIGHTS) only loops over the lights of its own
+// cluster, so the cost per fragment stays about the same with thousands of lights.
+// GL 3.3 has neither SSBOs nor compute shaders: the lights, the per-cluster (offset, count)
+// ranges and the light index lists are uploaded in texture buffers.
+class ClusteredLights {
+public:
+    static const int kClustersX = 16;
+    static const int kClustersY = 9;
+    static const int kClustersZ = 24;
+
+    // Bins the lights for a camera. viewportWidth and viewportHeight are used by the shader
+    // to find the tile of a fragment.
+    void update(const std::vector<PointLight> &lights, const glm::mat4 &viewMatrix, float fovY, float aspectRatio,
+                float near, float far, int viewportWidth, int viewportHeight);
+    // Binds the three texture buffers on units firstUnit..firstUnit+2 and sets the cluster* uniforms.
+    void bind(GLuint program, int firstUnit) const;
+    inline size_t getNumIndices() const { return m_indices.size(); }
+    // Deletes the texture buffers, while the context is current.
+    void clear();
+
+private:
+    void init();
+
+    GLuint m_buffers[3] = {0, 0, 0};  // lights, cluster ranges, light indices
+    GLuint m_textures[3] = {0, 0, 0};
+    float m_near = 0.1f, m_far = 100.f;
+    int m_viewportWidth = 1, m_viewportHeight = 1;
+
+    std::vector<float> m_lightData;   // 2 RGBA32F texels per light: position + radius, color
+    std::vector<uint32_t> m_ranges;   // RG32UI per cluster: first index, count
+    std::vector<uint32_t> m_indices;  // R32UI
+};
+
+#endif // CLUSTERED_LIGHTS_H
@@ -0,0 +1,134 @@
+#include "dynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+const double kSmoothing = 0.1;    // weight of the newest GPU time in the running average
+const double kRaiseBelow = 0.8;   // the scale only goes up when well under budget, for stability
+const float kScaleStep = 0.05f;   // scales are quantized to avoid resizing the viewport every frame
+const int kMinSamples = 8;        // GPU times to average at a scale before changing it
+
+} // namespace
+
+void DynamicResolution::setScaleRange(float minScale, float maxScale)
+{
+    m_maxScale = std::min(std::max(maxScale, 0.1f), 1.f);
+    m_minScale = std::min(std::max(minScale, 0.1f), m_maxScale);
+    m_scale = std::min(std::max(m_scale, m_minScale), m_maxScale);
+}
+
+void DynamicResolution::resize(int windowWidth, int windowHeight)
+{
+    if (windowWidth == m_windowWidth && windowHeight == m_windowHeight && m_fbo != 0)
+        return;
+    m_windowWidth = std::max(1, windowWidth);
+    m_windowHeight = std::max(1, windowHeight);
+    if (m_fbo == 0) {
+        glGenFramebuffers(1, &m_fbo);
+        glGenTextures(1, &m_colorTex);
+        glGenRenderbuffers(1, &m_depthRb);
+        glGenQueries(kNumQueries, m_queries);
+    }
+    const int width = std::max(1, static_cast<int>(std::ceil(m_windowWidth * m_maxScale)));
+    const int height = std::max(1, static_cast<int>(std::ceil(m_windowHeight * m_maxScale)));
+    glBindTexture(GL_TEXTURE_2D, m_colorTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, m_depthFormat, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_colorTex, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthRb);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "ERROR: incomplete dynamic resolution framebuffer" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DynamicResolution::clear()
+{
+    if (m_fbo != 0) {
+        glDeleteFramebuffers(1, &m_fbo);
+        glDeleteTextures(1, &m_colorTex);
+        glDeleteRenderbuffers(1, &m_depthRb);
+        glDeleteQueries(kNumQueries, m_queries);
+    }
+    m_fbo = m_colorTex = m_depthRb = 0;
+    for (int i = 0; i < kNumQueries; i++) {
+        m_queries[i] = 0;
+        m_queryPending[i] = false;
+    }
+    m_windowWidth = m_windowHeight = 0;
+}
+
+void DynamicResolution::begin()
+{
+    m_renderWidth = std::max(1, static_cast<int>(m_windowWidth * m_scale));
+    m_renderHeight = std::max(1, static_cast<int>(m_windowHeight * m_scale));
+    const int q = m_frame % kNumQueries;
+    if (!m_queryPending[q]) {
+        glBeginQuery(GL_TIME_ELAPSED, m_queries[q]);
+        m_queryPending[q] = true;
+        m_queryScale[q] = m_scale;
+    }
+    else {
+        m_queryPending[q] = false; // the GPU is more than kNumQueries frames behind, skip timing this frame
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glViewport(0, 0, m_renderWidth, m_renderHeight);
+}
+
+void DynamicResolution::end()
+{
+    const int q = m_frame % kNumQueries;
+    if (m_queryPending[q])
+        glEndQuery(GL_TIME_ELAPSED);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_outputFbo);
+    glBlitFramebuffer(0, 0, m_renderWidth, m_renderHeight, 0, 0, m_windowWidth, m_windowHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_outputFbo);
+    glViewport(0, 0, m_windowWidth, m_windowHeight);
+    m_frame++;
+    updateScale();
+}
+
+void DynamicResolution::updateScale()
+{
+    // oldest pending query first, only if the GPU is done with it
+    for (int i = 0; i < kNumQueries; i++) {
+        const int q = (m_frame + i) % kNumQueries;
+        if (!m_queryPending[q])
+            continue;
+        GLint available = 0;
+        glGetQueryObjectiv(m_queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(m_queries[q], GL_QUERY_RESULT, &ns);
+        m_queryPending[q] = false;
+        if (m_queryScale[q] != m_scale)
+            continue; // rendered before the last scale change
+        const double ms = ns * 1e-6;
+        m_gpuMs = m_samples == 0 ? ms : (1.0 - kSmoothing) * m_gpuMs + kSmoothing * ms;
+        m_samples++;
+    }
+    if (m_samples < kMinSamples)
+        return;
+    // the GPU time of a fill-rate bound scene is roughly proportional to its pixel count
+    float target = m_scale;
+    if (m_gpuMs > m_budgetMs)
+        target = m_scale * static_cast<float>(std::sqrt(m_budgetMs / m_gpuMs));
+    else if (m_gpuMs < m_budgetMs * kRaiseBelow)
+        target = m_scale + kScaleStep;
+    target = std::floor(target / kScaleStep + 0.5f) * kScaleStep;
+    target = std::min(std::max(target, m_minScale), m_maxScale);
+    if (target != m_scale) {
+        m_scale = target;
+        m_samples = 0; // measure the new scale from scratch
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+
+// Dynamic resolution scaling: the scene is rendered offscreen at a fraction of the window
+// resolution, then upscaled to the window with a bilinear blit. The GPU time of the scene is
+// measured with timer queries (read back a few frames later, never stalling) and the scale
+// is adjusted to keep it under the budget, within [minScale, maxScale]. The render target is
+// allocated once at maxScale, a smaller scale only renders into a corner of it.
+// With the scale range set to [1, 1], it is just the offscreen target of the scene (e.g. to
+// get a float depth buffer the window framebuffer does not offer).
+class DynamicResolution {
+public:
+    inline void setBudgetMs(double ms) { m_budgetMs = ms; }
+    // Depth buffer format of the render target, to set before the first resize
+    inline void setDepthFormat(GLenum format) { m_depthFormat = format; }
+    // Framebuffer the scene is upscaled into, the window's (0) by default
+    inline void setOutputFramebuffer(GLuint fbo) { m_outputFbo = fbo; }
+    void setScaleRange(float minScale, float maxScale);
+    inline float getScale() const { return m_scale; }
+    inline double getGpuMs() const { return m_gpuMs; }
+    inline int getRenderWidth() const { return m_renderWidth; }
+    inline int getRenderHeight() const { return m_renderHeight; }
+
+    // (Re)allocates the render target when the window framebuffer size changed.
+    void resize(int windowWidth, int windowHeight);
+    // Redirects the rendering to the scaled target and starts timing.
+    void begin();
+    // Stops timing, upscales into the window framebuffer and updates the scale.
+    void end();
+    // Deletes the render target and the timer queries, while the context is current.
+    void clear();
+
+private:
+    static const int kNumQueries = 4; // results are read kNumQueries - 1 frames late
+
+    void updateScale();
+
+    double m_budgetMs = 14.0;
+    float m_minScale = 0.5f, m_maxScale = 1.f, m_scale = 1.f;
+    double m_gpuMs = 0.0;              // smoothed scene GPU time
+    int m_windowWidth = 0, m_windowHeight = 0;
+    int m_renderWidth = 0, m_renderHeight = 0;
+    GLenum m_depthFormat = GL_DEPTH_COMPONENT24;
+    GLuint m_fbo = 0, m_colorTex = 0, m_depthRb = 0;
+    GLuint m_outputFbo = 0;
+    GLuint m_queries[kNumQueries] = {0, 0, 0, 0};
+    bool m_queryPending[kNumQueries] = {false, false, false, false};
+    float m_queryScale[kNumQueries] = {0.f, 0.f, 0.f, 0.f}; // scale the timed frame was rendered at
+    int m_samples = 0;                 // GPU times measured at the current scale
+    int m_frame = 0;
+};
+
+#endif // DYNAMIC_RESOLUTION_H
@@ -1,21 +1,91 @@
 #version 330 core	     // Minimal GL version support expected from the GPU
 
+// Permutations (see shaderPermutations.h): the material is one of LIT, EMISSIVE, SKY or
+// ATMOSPHERE_SHELL, the albedo comes from a 2D texture, ALBEDO_ARRAY, SKY_CUBEMAP or
+// VIRTUAL_TEXTURE, and LIT materials add the local lights with CLUSTERED_LIGHTS and the
+// effect of the air with ATMOSPHERE.
+#if !defined(EMISSIVE) && !defined(SKY) && !defined(ATMOSPHERE_SHELL) && !defined(LIT)
+#define LIT
+#endif
+
 struct Material {
 // ...
+#if defined(SKY_CUBEMAP)
+	samplerCube albedoTex; // sky cubemap, sampled by direction
+#elif defined(ALBEDO_ARRAY)
+	sampler2DArray albedoTex; // albedo maps of all the bodies, one per layer
+	int albedoLayer;
+#else
 	sampler2D albedoTex; // texture unit, relate to glActivateTexture(GL_TEXTURE0 + i)
+#endif
 };
 uniform Material material;
+// same block as in vertexShader.glsl
+layout(std140) uniform Camera {
+	mat4 viewMat;
+	mat4 projMat;
+	vec3 camPos;
+};
 in vec2 fTexCoord;
-
+in vec3 fPosition;
 uniform vec3 worldPos;
-uniform vec3 camPos;
+
+#ifdef VIRTUAL_TEXTURE
+// Tiled virtual texture, see virtualTexture.h: the indirection texture gives, for each page of
+// each level, the cache slot holding it (or holding its closest resident ancestor).
+uniform sampler2D vtCache;
+uniform usampler2D vtIndirection;
+uniform ivec2 vtPages;     // pages of level 0
+uniform int vtNumLevels;
+uniform int vtPageSize;
+uniform int vtBorder;
+uniform int vtId;
+uniform float vtCacheSize; // cache texture size in texels
+uniform float vtLodBias;
+
+float vtLod() {
+	vec2 texels = fTexCoord * vec2(vtPages * vtPageSize);
+	vec2 dx = dFdx(texels), dy = dFdy(texels);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vtLodBias;
+	return clamp(lod, 0.0, float(vtNumLevels - 1));
+}
+
+ivec2 vtPageAt(vec2 uv, int level) {
+	ivec2 n = max(vtPages >> level, ivec2(1));
+	return clamp(ivec2(uv * vec2(n)), ivec2(0), n - 1);
+}
+
+vec3 vtSample() {
+	vec2 uv = fract(fTexCoord);
+	int level = int(vtLod());
+	uvec4 e = texelFetch(vtIndirection, vtPageAt(uv, level), level);
+	int mapped = int(e.b);
+	vec2 inPage = clamp(uv * vec2(vtPages >> mapped) - vec2(vtPageAt(uv, mapped)), 0.0, 1.0);
+	vec2 texel = vec2(e.rg) * float(vtPageSize + 2 * vtBorder) + float(vtBorder) + inPage * float(vtPageSize);
+	return textureLod(vtCache, texel / vtCacheSize, 0.0).rgb;
+}
+#endif
+
+vec3 albedo() {
+#ifdef VIRTUAL_TEXTURE
+	return vtSample();
+#elif defined(SKY_CUBEMAP)
+	return texture(material.albedoTex, normalize(fPosition - worldPos)).rgb;
+#elif defined(ALBEDO_ARRAY)
+	return texture(material.albedoTex, vec3(fTexCoord, material.albedoLayer)).rgb;
+#else
+	return texture(material.albedoTex, fTexCoord).rgb;
+#endif
+}
+
 uniform vec3 surfaceColor;
 uniform vec3 lightPos;
-uniform int isLight;
-uniform int isSky;
-in vec3 fPosition;
 in vec3 fNormal;
+#ifdef VT_FEEDBACK
+out uvec4 color;  // page needed by this fragment, read back by VirtualTextureSystem::update
+#else
 out vec4 color;	  // Shader output: the color response attached to this fragment
+#endif
 
 const vec3 lightColor = vec3(1.0, 1.0, 1.0);
 const float ka = 0.1;
@@ -23,32 +93,217 @@ const float kd = 1.0;
 const float ks = 0.8;
 const float shininess = 2.0;
 
+// Eclipses: the bodies that may stand between this one and the sun (culled on the CPU) are
+// spheres, so the visible fraction of the sun disk is estimated analytically.
+const int kMaxOccluders = 4;
+uniform vec4 occluders[kMaxOccluders]; // center, radius
+uniform int numOccluders;
+uniform float sunRadius;
+
+float sunVisibility(vec3 p) {
+	vec3 toSun = lightPos - p;
+	float sunDistance = length(toSun);
+	float a = sunRadius / sunDistance; // angular radii, small angle approximation
+	float visibility = 1.0;
+	for (int i = 0; i < numOccluders; i++) {
+		vec3 toOccluder = occluders[i].xyz - p;
+		float d = length(toOccluder);
+		if (d >= sunDistance)
+			continue;
+		float b = occluders[i].w / d;
+		float c = acos(clamp(dot(toSun, toOccluder) / (sunDistance * d), -1.0, 1.0)); // angular separation
+		// from no overlap (c >= a + b) to the smaller disk inside the larger one (c <= |a - b|),
+		// umbra when the occluder covers the whole sun
+		float covered = min(b * b / (a * a), 1.0);
+		visibility *= 1.0 - covered * (1.0 - smoothstep(abs(a - b), a + b, c));
+	}
+	return visibility;
+}
+
+#ifdef CLUSTERED_LIGHTS
+// Local point lights binned per view cluster, see clusteredLights.h
+uniform samplerBuffer lightData;      // 2 texels per light: position + radius, color
+uniform usamplerBuffer clusterRanges; // per cluster: first index, count
+uniform usamplerBuffer lightIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterDepth;            // near plane, slices / log(far / near)
+uniform vec2 viewportSize;
+
+vec3 clusteredLighting(vec3 n, vec3 v, vec3 texColor) {
+	float viewZ = -(viewMat * vec4(fPosition, 1.0)).z;
+	ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy / viewportSize * vec2(clusterDims.xy)),
+	                      int(log(max(viewZ, clusterDepth.x) / clusterDepth.x) * clusterDepth.y));
+	cluster = clamp(cluster, ivec3(0), clusterDims - 1);
+	uvec2 range = texelFetch(clusterRanges, (cluster.z * clusterDims.y + cluster.y) * clusterDims.x + cluster.x).xy;
+	vec3 result = vec3(0.0);
+	for (uint i = 0u; i < range.y; i++) {
+		int light = int(texelFetch(lightIndices, int(range.x + i)).x);
+		vec4 positionRadius = texelFetch(lightData, 2 * light);
+		vec3 toLight = positionRadius.xyz - fPosition;
+		float d = length(toLight);
+		float attenuation = clamp(1.0 - d / positionRadius.w, 0.0, 1.0);
+		if (attenuation <= 0.0)
+			continue;
+		vec3 l = toLight / d;
+		float diffuse = kd * max(dot(n, l), 0.0);
+		float specular = diffuse > 0.0 ? ks * pow(max(dot(v, reflect(-l, n)), 0.0), shininess) : 0.0;
+		result += attenuation * attenuation * (diffuse + specular) * texColor * texelFetch(lightData, 2 * light + 1).rgb;
+	}
+	return result;
+}
+#endif
+
+#if defined(ATMOSPHERE) || defined(ATMOSPHERE_SHELL)
+// Precomputed atmospheric scattering, see atmosphere.h. Lengths are in km, in a frame centered
+// on the planet (worldPos); the parameterizations of the tables match atmosphere.cpp.
+uniform sampler2D transmittanceLut; // (view zenith, altitude)
+uniform sampler3D scatteringLut;    // (view-sun angle, sun zenith) x view zenith x altitude
+uniform sampler2D irradianceLut;    // (sun zenith, altitude)
+uniform int scatteringNuSize;       // view-sun angle slices packed along x
+uniform vec2 atmosphereRadii;       // ground, top
+uniform vec3 rayleighScattering;
+uniform float mieG;
+uniform float kmPerUnit;
+
+const float kPi = 3.14159265;
+// The Phong terms bring a white surface facing the sun to 1, i.e. radiances are scaled by pi
+const float kSunRadianceScale = kPi;
+
+// Transmittance from radius r to the top of the atmosphere, in direction mu (cosine of the zenith angle)
+vec3 transmittance(float r, float mu) {
+	float uR = sqrt(max(r - atmosphereRadii.x, 0.0) / (atmosphereRadii.y - atmosphereRadii.x));
+	float uMu = atan((mu + 0.15) / 1.15 * tan(1.5)) / 1.5;
+	return texture(transmittanceLut, vec2(uMu, uR)).rgb;
+}
+
+// Transmittance along a segment of length d, which must not cross the ground
+vec3 transmittance(float r, float mu, float d) {
+	float ri = sqrt(d * d + r * r + 2.0 * r * mu * d);
+	float mui = (r * mu + d) / ri;
+	vec3 t = mu > 0.0 ? transmittance(r, mu) / max(transmittance(ri, mui), vec3(1e-6))
+	                  : transmittance(ri, -mui) / max(transmittance(r, -mu), vec3(1e-6));
+	return min(t, vec3(1.0));
+}
+
+// Sunlight scattered once towards radius r, Rayleigh in RGB and the red of Mie in alpha
+vec4 scattering(float r, float mu, float muS, float nu) {
+	float Rg = atmosphereRadii.x, Rt = atmosphereRadii.y;
+	vec3 size = vec3(textureSize(scatteringLut, 0));
+	float resNu = float(scatteringNuSize), resMuS = size.x / resNu, resMu = size.y, resR = size.z;
+	r = clamp(r, Rg + 0.05, Rt);
+	float H = sqrt(Rt * Rt - Rg * Rg);
+	float rho = sqrt(r * r - Rg * Rg);
+	float rmu = r * mu;
+	float delta = rmu * rmu - r * r + Rg * Rg;
+	// the rays hitting the ground use the first half of the mu axis, the others the second half
+	vec4 cst = rmu < 0.0 && delta > 0.0 ? vec4(1.0, 0.0, 0.0, 0.5 - 0.5 / resMu) : vec4(-1.0, H * H, H, 0.5 + 0.5 / resMu);
+	float uR = 0.5 / resR + rho / H * (1.0 - 1.0 / resR);
+	float uMu = cst.w + (rmu * cst.x + sqrt(max(delta + cst.y, 0.0))) / (rho + cst.z) * (0.5 - 1.0 / resMu);
+	float uMuS = 0.5 / resMuS + (atan(max(muS, -0.1975) * tan(1.26 * 1.1)) / 1.1 + (1.0 - 0.26)) * 0.5 * (1.0 - 1.0 / resMuS);
+	float slice = (nu + 1.0) / 2.0 * (resNu - 1.0);
+	float uNu = floor(slice);
+	return mix(texture(scatteringLut, vec3((uNu + uMuS) / resNu, uMu, uR)),
+	           texture(scatteringLut, vec3((uNu + uMuS + 1.0) / resNu, uMu, uR)), slice - uNu);
+}
+
+// Radiance of the scattered light, the Mie RGB being rebuilt from its red and the Rayleigh ratios
+vec3 scatteredLight(vec4 s, float nu) {
+	vec3 mie = s.rgb * s.a / max(s.r, 1e-4) * (rayleighScattering.r / rayleighScattering);
+	float phaseRayleigh = 3.0 / (16.0 * kPi) * (1.0 + nu * nu);
+	float g2 = mieG * mieG;
+	float phaseMie = 1.5 / (4.0 * kPi) * (1.0 - g2) * pow(1.0 + g2 - 2.0 * mieG * nu, -1.5) * (1.0 + nu * nu) / (2.0 + g2);
+	return kSunRadianceScale * (s.rgb * phaseRayleigh + mie * phaseMie);
+}
+
+// Light of the sky received by the ground, for a sun of irradiance 1
+vec3 skyIrradiance(float r, float muS) {
+	vec2 size = vec2(textureSize(irradianceLut, 0));
+	vec2 uv = vec2((muS + 0.2) / 1.2, (r - atmosphereRadii.x) / (atmosphereRadii.y - atmosphereRadii.x));
+	return texture(irradianceLut, (0.5 + clamp(uv, 0.0, 1.0) * (size - 1.0)) / size).rgb;
+}
+
+// Camera position in the planet frame, moved along the view ray v to where it enters the
+// atmosphere. False when the ray misses the atmosphere.
+bool atmosphereEntry(vec3 v, out vec3 x) {
+	x = (camPos - worldPos) * kmPerUnit;
+	float Rt = atmosphereRadii.y;
+	float r = length(x), rmu = dot(x, v);
+	if (r <= Rt)
+		return true;
+	float delta = rmu * rmu - r * r + Rt * Rt;
+	if (delta < 0.0 || rmu > 0.0)
+		return false;
+	x += (-rmu - sqrt(delta)) * v;
+	return true;
+}
+#endif
+
 void main() {
-	if (isLight != 0) {
-		vec3 texColor = texture(material.albedoTex, fTexCoord).rgb;
-		color = vec4(0.8 * texColor, 1);
-	} 
-	else if (isSky != 0) {
-		vec3 texColor = texture(material.albedoTex, fTexCoord).rgb;
-		color = vec4(0.8 * texColor, 1);
+#ifdef VT_FEEDBACK
+	int level = int(vtLod());
+	color = uvec4(uvec2(vtPageAt(fract(fTexCoord), level)), uint(level), uint(vtId + 1));
+#elif defined(EMISSIVE) || defined(SKY)
+	vec3 texColor = albedo();
+	color = vec4(0.8 * texColor, 1);
+#elif defined(ATMOSPHERE_SHELL)
+	// light scattered between the camera and the ground or space behind the fragment, added
+	// to what the body already drew (the ground drew itself attenuated, see ATMOSPHERE)
+	vec3 v = normalize(fPosition - camPos);
+	vec3 s = normalize(lightPos - worldPos);
+	vec3 x;
+	if (!atmosphereEntry(v, x))
+		discard;
+	float r = length(x), mu = dot(x, v) / r, nu = dot(v, s);
+	vec4 inscatter = scattering(r, mu, dot(x, s) / r, nu);
+	float Rg = atmosphereRadii.x;
+	float delta = r * r * (mu * mu - 1.0) + Rg * Rg;
+	if (mu < 0.0 && delta > 0.0) {
+		// the ground stops the ray: remove the light scattered beyond it
+		float d = -r * mu - sqrt(delta);
+		vec3 x0 = x + d * v;
+		float r0 = length(x0);
+		inscatter = max(inscatter - transmittance(r, mu, d).rgbr * scattering(r0, dot(x0, v) / r0, dot(x0, s) / r0, nu), 0.0);
 	}
-	else {
-
-		vec3 texColor = texture(material.albedoTex, fTexCoord).rgb; // sample the texture color
-		vec3 n = normalize(fNormal);
-		vec3 l = normalize(lightPos - worldPos);
-		vec3 v = normalize(camPos - fPosition);
-		vec3 r = reflect(-l, n);
-
-		vec3 ambient = ka * lightColor;
-		vec3 diffuse = kd * max(dot(n, l), 0.0) * texColor * lightColor;
-		vec3 specular;
-		if (dot(n, l) > 0) {
+	color = vec4(scatteredLight(inscatter, nu), 1.0);
+#else
+	vec3 texColor = albedo(); // sample the texture color
+	vec3 n = normalize(fNormal);
+	vec3 l = normalize(lightPos - worldPos);
+	vec3 v = normalize(camPos - fPosition);
+	vec3 r = reflect(-l, n);
+
+	vec3 ambient = ka * lightColor;
+	vec3 diffuse = kd * max(dot(n, l), 0.0) * texColor * lightColor;
+	vec3 specular;
+	if (dot(n, l) > 0) {
     		specular = ks * pow(max(dot(v, r), 0.0), shininess) * texColor * lightColor;
-		} else {
+	} else {
     		specular = vec3(0.0, 0.0, 0.0);
-		}
-	
-		color = vec4(ambient + diffuse + specular, 1.0); // Building RGBA from RGB.
 	}
+
+#ifdef ATMOSPHERE
+	// sunlight reddened by the air above the ground, plus the light of the sky
+	vec3 x0 = (fPosition - worldPos) * kmPerUnit;
+	float r0 = max(length(x0), atmosphereRadii.x);
+	float muS0 = dot(x0, l) / length(x0);
+	vec3 sunTransmittance = transmittance(r0, muS0);
+	diffuse *= sunTransmittance;
+	specular *= sunTransmittance;
+	ambient += kd * texColor * skyIrradiance(r0, muS0);
+#endif
+
+	float shadow = numOccluders > 0 ? sunVisibility(fPosition) : 1.0;
+	color = vec4(ambient + shadow * (diffuse + specular), 1.0); // Building RGBA from RGB.
+#ifdef CLUSTERED_LIGHTS
+	color.rgb += clusteredLighting(n, v, texColor);
+#endif
+#ifdef ATMOSPHERE
+	// seen through the air, whose own light is added by the shell pass
+	vec3 x;
+	if (atmosphereEntry(-v, x)) {
+		float r = length(x);
+		color.rgb *= transmittance(r, dot(x, -v) / r, distance(x, x0));
+	}
+#endif
+#endif
 }
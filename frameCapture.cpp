@@ -0,0 +1,314 @@
+#include "frameCapture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const size_t kMaxStoredBlock = 65535; // deflate stored block payload
+
+// File name of a capture: the first %d (or %0Nd) of the pattern replaced by the number, or else
+// the number appended before the extension
+std::string captureFilename(const std::string &pattern, uint64_t number)
+{
+    const size_t percent = pattern.find('%');
+    if (percent != std::string::npos) {
+        size_t end = percent + 1;
+        while (end < pattern.size() && pattern[end] >= '0' && pattern[end] <= '9')
+            end++;
+        if (end < pattern.size() && pattern[end] == 'd' && end - percent <= 4) {
+            char digits[32];
+            std::snprintf(digits, sizeof(digits), ("%" + pattern.substr(percent + 1, end - percent - 1) + "llu").c_str(),
+                          static_cast<unsigned long long>(number));
+            return pattern.substr(0, percent) + digits + pattern.substr(end + 1);
+        }
+    }
+    const size_t dot = pattern.rfind('.');
+    const size_t split = dot == std::string::npos ? pattern.size() : dot;
+    return pattern.substr(0, split) + "_" + std::to_string(number) + pattern.substr(split);
+}
+
+bool hasExtension(const std::string &name, const std::string &extension)
+{
+    return name.size() >= extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc = 0)
+{
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t adler32(const unsigned char *data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        const size_t n = std::min<size_t>(size, 5552); // largest run without overflow
+        for (size_t i = 0; i < n; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += n;
+        size -= n;
+    }
+    return (b << 16) | a;
+}
+
+void putBigEndian(std::vector<unsigned char> &out, uint32_t value)
+{
+    out.push_back(static_cast<unsigned char>(value >> 24));
+    out.push_back(static_cast<unsigned char>(value >> 16));
+    out.push_back(static_cast<unsigned char>(value >> 8));
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+void writeChunk(std::ofstream &file, const char *type, const std::vector<unsigned char> &data)
+{
+    std::vector<unsigned char> header;
+    putBigEndian(header, static_cast<uint32_t>(data.size()));
+    header.insert(header.end(), type, type + 4);
+    const uint32_t crc = crc32(data.data(), data.size(), crc32(header.data() + 4, 4));
+    std::vector<unsigned char> trailer;
+    putBigEndian(trailer, crc);
+    file.write(reinterpret_cast<const char *>(header.data()), header.size());
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    file.write(reinterpret_cast<const char *>(trailer.data()), trailer.size());
+}
+
+// RGB PNG of bottom-up RGBA8 rows, stored without compression
+void writePng(std::ofstream &file, const unsigned char *pixels, int width, int height)
+{
+    // scanlines top first, filter 0, alpha dropped
+    const size_t lineSize = 1 + static_cast<size_t>(width) * 3;
+    std::vector<unsigned char> lines(lineSize * height);
+    for (int y = 0; y < height; y++) {
+        const unsigned char *src = pixels + static_cast<size_t>(height - 1 - y) * width * 4;
+        unsigned char *dst = &lines[y * lineSize];
+        *dst++ = 0;
+        for (int x = 0; x < width; x++, src += 4) {
+            *dst++ = src[0];
+            *dst++ = src[1];
+            *dst++ = src[2];
+        }
+    }
+
+    std::vector<unsigned char> ihdr;
+    putBigEndian(ihdr, static_cast<uint32_t>(width));
+    putBigEndian(ihdr, static_cast<uint32_t>(height));
+    const unsigned char format[] = {8, 2, 0, 0, 0}; // 8 bits, RGB, deflate, no filter choice, no interlace
+    ihdr.insert(ihdr.end(), format, format + 5);
+
+    std::vector<unsigned char> idat;
+    idat.reserve(lines.size() + lines.size() / kMaxStoredBlock * 5 + 16);
+    idat.push_back(0x78); // zlib, 32K window, no compression level
+    idat.push_back(0x01);
+    for (size_t offset = 0; offset < lines.size() || offset == 0; offset += kMaxStoredBlock) {
+        const size_t size = std::min(kMaxStoredBlock, lines.size() - offset);
+        idat.push_back(offset + size == lines.size() ? 1 : 0); // final block, stored
+        idat.push_back(static_cast<unsigned char>(size));
+        idat.push_back(static_cast<unsigned char>(size >> 8));
+        idat.push_back(static_cast<unsigned char>(~size));
+        idat.push_back(static_cast<unsigned char>(~size >> 8));
+        idat.insert(idat.end(), lines.begin() + offset, lines.begin() + offset + size);
+    }
+    putBigEndian(idat, adler32(lines.data(), lines.size()));
+
+    const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    file.write(reinterpret_cast<const char *>(signature), sizeof(signature));
+    writeChunk(file, "IHDR", ihdr);
+    writeChunk(file, "IDAT", idat);
+    writeChunk(file, "IEND", std::vector<unsigned char>());
+}
+
+} // namespace
+
+FrameCapture::~FrameCapture()
+{
+    stopEncoder(); // the buffers went with clear()
+}
+
+void FrameCapture::start(const std::string &pattern, int maxFrames)
+{
+    m_pattern = pattern;
+    m_remaining = maxFrames > 0 ? maxFrames : -1;
+    if (!m_thread.joinable()) {
+        m_written = m_dropped = m_renderThreadFrames = 0;
+        m_renderThreadTime = std::chrono::steady_clock::duration::zero();
+        m_quit = false;
+        m_thread = std::thread(&FrameCapture::run, this);
+    }
+}
+
+void FrameCapture::stop()
+{
+    m_remaining = 0;
+    if (!m_thread.joinable())
+        return;
+    for (bool busy = true; busy;) {
+        collect(true);
+        busy = false;
+        for (const Slot &slot : m_slots)
+            busy = busy || slot.state != kFree;
+        if (busy)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1)); // the encoder is writing
+    }
+    stopEncoder();
+    if (m_renderThreadFrames > 0) {
+        const double ms = std::chrono::duration<double, std::milli>(m_renderThreadTime).count() / m_renderThreadFrames;
+        std::cout << "capture: " << m_written << " frames written, " << m_dropped << " dropped, " << ms
+                  << " ms per frame on the render thread" << std::endl;
+    }
+}
+
+void FrameCapture::clear()
+{
+    stop();
+    for (Slot &slot : m_slots) {
+        if (slot.pbo != 0)
+            glDeleteBuffers(1, &slot.pbo);
+        slot.pbo = 0;
+        slot.size = 0;
+    }
+}
+
+void FrameCapture::stopEncoder()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void FrameCapture::capture(GLuint framebuffer, int width, int height)
+{
+    if (m_remaining == 0)
+        return;
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    Slot *slot = nullptr;
+    for (Slot &s : m_slots) {
+        if (s.state == kFree) {
+            slot = &s;
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        m_dropped++; // the encoder is behind
+    }
+    else {
+        const GLsizeiptr size = static_cast<GLsizeiptr>(width) * height * 4;
+        if (slot->pbo == 0)
+            glGenBuffers(1, &slot->pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+        if (slot->size != size) {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+            slot->size = size;
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0); // into the buffer, asynchronously
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot->width = width;
+        slot->height = height;
+        slot->filename = captureFilename(m_pattern, m_number++);
+        slot->state = kReading;
+        if (m_remaining > 0)
+            m_remaining--;
+    }
+    m_renderThreadTime += std::chrono::steady_clock::now() - begin;
+    m_renderThreadFrames++;
+}
+
+void FrameCapture::update()
+{
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    collect(false);
+    m_renderThreadTime += std::chrono::steady_clock::now() - begin;
+}
+
+void FrameCapture::collect(bool wait)
+{
+    for (int i = 0; i < kNumSlots; i++) {
+        Slot &slot = m_slots[i];
+        if (slot.state == kEncoded) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            slot.pixels = nullptr;
+            slot.state = kFree;
+            m_written++;
+        }
+        else if (slot.state == kReading) {
+            const GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+                continue;
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            slot.pixels = static_cast<const unsigned char *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT));
+            slot.state = kEncoding;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_queue.push_back(i);
+            }
+            m_wake.notify_one();
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void FrameCapture::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wake.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+        if (m_queue.empty())
+            break;
+        const int i = m_queue.front();
+        m_queue.pop_front();
+        lock.unlock();
+        encode(m_slots[i]);
+        m_slots[i].state = kEncoded;
+        lock.lock();
+    }
+}
+
+void FrameCapture::encode(const Slot &slot) const
+{
+    if (slot.pixels == nullptr) {
+        std::cerr << "ERROR: could not map the capture of " << slot.filename << std::endl;
+        return;
+    }
+    std::ofstream file(slot.filename.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: cannot write " << slot.filename << std::endl;
+        return;
+    }
+    if (hasExtension(slot.filename, ".png")) {
+        writePng(file, slot.pixels, slot.width, slot.height);
+        return;
+    }
+    const size_t rowSize = static_cast<size_t>(slot.width) * 4;
+    for (int y = slot.height - 1; y >= 0; y--)
+        file.write(reinterpret_cast<const char *>(slot.pixels + y * rowSize), rowSize);
+}
@@ -0,0 +1,73 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <glad/glad.h>
+
+// Frame capture without pipeline stalls. capture() only queues a glReadPixels into a pixel
+// pack buffer of a ring, followed by a fence; update() maps the buffers whose fence has passed,
+// a few frames later, and hands the mapped pixels to an encoder thread, which writes the file
+// (PNG with stored deflate blocks: fast to write, not compressed; or raw RGBA rows). The
+// buffer is unmapped and reused once the encoder is done. When all the buffers are in flight
+// the frame is dropped rather than waiting.
+class FrameCapture {
+public:
+    ~FrameCapture();
+
+    // Captures the next frames (all of them when maxFrames is 0) to the files named from
+    // pattern, where %d or %0Nd stands for a running capture number, e.g. "capture/%05d.png". The
+    // extension picks the format: .png, otherwise raw RGBA8 rows, top row first.
+    void start(const std::string &pattern, int maxFrames = 0);
+    // Writes the frames in flight, waiting for them, and stops the encoder.
+    void stop();
+    // Stops and deletes the pixel buffers, while the context is current.
+    void clear();
+    inline bool isActive() const { return m_remaining != 0; }
+
+    // Reads the color buffer of framebuffer (0: the back buffer), before the swap.
+    void capture(GLuint framebuffer, int width, int height);
+    // Hands the finished readbacks to the encoder and recycles its buffers, once per frame.
+    void update();
+
+private:
+    static const int kNumSlots = 4;
+    enum SlotState { kFree, kReading, kEncoding, kEncoded };
+    struct Slot {
+        GLuint pbo = 0;
+        GLsizeiptr size = 0;
+        GLsync fence = nullptr;
+        std::atomic<int> state{kFree};
+        int width = 0, height = 0;
+        std::string filename;
+        const unsigned char *pixels = nullptr; // mapped, while encoding
+    };
+
+    void collect(bool wait);
+    void stopEncoder();
+    void run();
+    void encode(const Slot &slot) const;
+
+    Slot m_slots[kNumSlots];
+    std::string m_pattern;
+    int m_remaining = 0;        // frames left to capture, -1: no limit
+    uint64_t m_number = 0;      // running capture number, for the file names
+    int m_written = 0, m_dropped = 0;
+    std::chrono::steady_clock::duration m_renderThreadTime{};
+    int m_renderThreadFrames = 0;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<int> m_queue;    // slots to encode
+    bool m_quit = false;
+};
+
+#endif // FRAME_CAPTURE_H
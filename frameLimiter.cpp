@@ -0,0 +1,53 @@
+#include "frameLimiter.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+const double kMinSpinUs = 200.0;  // spin at least this long, the oversleep varies
+const double kSmoothing = 0.1;    // weight of the last oversleep measure
+
+} // namespace
+
+void FrameLimiter::setMaxFps(double fps)
+{
+    if (fps == m_maxFps)
+        return;
+    m_maxFps = std::max(fps, 0.0);
+    m_period = m_maxFps > 0.0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / m_maxFps))
+                              : Clock::duration::zero();
+    m_next = Clock::now() + m_period;
+}
+
+void FrameLimiter::wait()
+{
+    if (m_period == Clock::duration::zero())
+        return;
+    Clock::time_point now = Clock::now();
+    if (now - m_next > m_period) {
+        // too late (a stall, an idle wait): start over from now
+        m_next = now + m_period;
+        return;
+    }
+
+    waitUntil(m_next);
+    m_next += m_period;
+}
+
+void FrameLimiter::waitUntil(Clock::time_point deadline)
+{
+    Clock::time_point now = Clock::now();
+    const std::chrono::microseconds margin(static_cast<long long>(std::max(2.0 * m_oversleepUs, kMinSpinUs)));
+    const Clock::time_point wakeUp = deadline - margin;
+    if (now < wakeUp) {
+        std::this_thread::sleep_until(wakeUp);
+        now = Clock::now();
+        const double oversleepUs = std::chrono::duration<double, std::micro>(now - wakeUp).count();
+        m_oversleepUs += kSmoothing * (oversleepUs - m_oversleepUs);
+    }
+    while (now < deadline) {
+        std::this_thread::yield();
+        now = Clock::now();
+    }
+}
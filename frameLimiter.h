@@ -0,0 +1,31 @@
+#ifndef FRAME_LIMITER_H
+#define FRAME_LIMITER_H
+
+#include <chrono>
+
+// Caps the frame rate of the loop. The OS sleep alone wakes up late (one scheduler tick or
+// more), a busy wait alone keeps a core at 100%: wait() sleeps until shortly before the end of
+// the frame slot, the margin following the oversleep measured so far, and spins (yielding)
+// for the rest. A frame later than a whole slot restarts the schedule instead of catching up.
+class FrameLimiter {
+public:
+    // 0 removes the cap
+    void setMaxFps(double fps);
+    inline double getMaxFps() const { return m_maxFps; }
+
+    // Returns at the start of the next frame slot, immediately when uncapped.
+    void wait();
+
+    typedef std::chrono::steady_clock Clock;
+    // Sleeps and spins until a time point, with the same precision
+    void waitUntil(Clock::time_point deadline);
+
+private:
+
+    double m_maxFps = 0.0;
+    Clock::duration m_period = Clock::duration::zero();
+    Clock::time_point m_next;
+    double m_oversleepUs = 1000.0; // smoothed measured oversleep
+};
+
+#endif // FRAME_LIMITER_H
@@ -0,0 +1,217 @@
+#include "framePacing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+const double kLateFrame = 1.5;      // in refresh periods, a frame interval that missed a vertical blank
+const double kMinMarginMs = 1.0;
+const double kMarginDecay = 0.99;   // per frame on time, after a miss doubled it
+
+struct ModeName {
+    PresentMode mode;
+    const char *name;
+};
+const ModeName kModeNames[] = {
+    {PresentMode::Vsync, "vsync"},
+    {PresentMode::Adaptive, "adaptive"},
+    {PresentMode::Uncapped, "uncapped"},
+    {PresentMode::Capped, "capped"},
+};
+
+double milliseconds(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// Value below which a fraction of the first n values lie
+double percentile(const std::vector<double> &values, size_t n, double fraction)
+{
+    std::vector<double> sorted(values.begin(), values.begin() + n);
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::min(n - 1, static_cast<size_t>(fraction * n))];
+}
+
+} // namespace
+
+const char *presentModeName(PresentMode mode)
+{
+    for (const ModeName &m : kModeNames) {
+        if (m.mode == mode)
+            return m.name;
+    }
+    return "?";
+}
+
+bool parsePresentMode(const std::string &name, PresentMode &mode)
+{
+    for (const ModeName &m : kModeNames) {
+        if (name == m.name) {
+            mode = m.mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+PresentMode FramePacing::init(GLFWwindow *window, PresentMode mode, bool deadline, double refreshRate)
+{
+    m_window = window;
+    if (window == nullptr)
+        mode = PresentMode::Uncapped;
+    if (mode == PresentMode::Adaptive && !glfwExtensionSupported("WGL_EXT_swap_control_tear") &&
+        !glfwExtensionSupported("GLX_EXT_swap_control_tear")) {
+        std::cerr << "WARNING: adaptive vsync is not supported, using vsync" << std::endl;
+        mode = PresentMode::Vsync;
+    }
+    m_mode = mode;
+    m_deadline = deadline && (mode == PresentMode::Vsync || mode == PresentMode::Adaptive);
+    if (deadline && !m_deadline)
+        std::cerr << "WARNING: the frame deadline needs the vsync or adaptive present mode" << std::endl;
+    if (refreshRate > 0.0)
+        m_refreshPeriod = 1.0 / refreshRate;
+    if (window != nullptr)
+        glfwSwapInterval(mode == PresentMode::Vsync ? 1 : mode == PresentMode::Adaptive ? -1 : 0);
+
+    GLuint queries[kNumQueries];
+    glGenQueries(kNumQueries, queries);
+    for (int i = 0; i < kNumQueries; i++)
+        m_pending[i].query = queries[i];
+    m_frameTimes.assign(kHistory, 0.0);
+    m_workTimes.assign(kHistory, 0.0);
+    m_latencies.assign(kHistory, 0.0);
+    calibrate();
+    return mode;
+}
+
+void FramePacing::calibrate()
+{
+    GLint64 gpuNs = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNs);
+    const int64_t clockNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    m_gpuToClockNs = clockNs - gpuNs;
+}
+
+void FramePacing::beginFrame()
+{
+    if (m_deadline && m_hasVblank && m_workCount > 0) {
+        // end right before the next vertical blank, with most recent frames
+        const double workMs = percentile(m_workTimes, std::min(m_workCount, kHistory), 0.95);
+        const double startMs = m_refreshPeriod * 1000.0 - workMs - m_marginMs;
+        if (startMs > 0.0)
+            m_waiter.waitUntil(m_lastVblank + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(startMs)));
+    }
+    m_frameStart = Clock::now();
+    if (m_hasLastFrame)
+        m_frameTimes[m_frameCount++ % kHistory] = milliseconds(m_frameStart - m_lastFrameStart);
+    m_lastFrameStart = m_frameStart;
+    m_hasLastFrame = true;
+    if (m_frameCount % kHistory == 0)
+        calibrate(); // follows the drift between the two clocks
+    readQueries();
+}
+
+void FramePacing::idle()
+{
+    m_hasLastFrame = false;
+    m_hasVblank = false;
+}
+
+void FramePacing::inputEvent()
+{
+    if (!m_hasInput) {
+        m_hasInput = true;
+        m_input = Clock::now();
+    }
+}
+
+void FramePacing::present()
+{
+    if (m_deadline) {
+        glFinish(); // the cost of the frame, before waiting for the vertical blank
+        m_workTimes[m_workCount++ % kHistory] = milliseconds(Clock::now() - m_frameStart);
+    }
+    if (m_window != nullptr)
+        glfwSwapBuffers(m_window);
+    else
+        glFlush();
+
+    // a query not read yet is reused: the GPU is kNumQueries frames behind, its sample is lost
+    PendingFrame &frame = m_pending[m_nextQuery];
+    glQueryCounter(frame.query, GL_TIMESTAMP);
+    frame.issued = true;
+    frame.hasInput = m_hasInput;
+    frame.input = m_input;
+    m_hasInput = false;
+    m_nextQuery = (m_nextQuery + 1) % kNumQueries;
+
+    if (m_deadline) {
+        glFinish(); // returns once the swap is done, at the vertical blank
+        const Clock::time_point now = Clock::now();
+        if (m_hasVblank && milliseconds(now - m_lastVblank) > kLateFrame * m_refreshPeriod * 1000.0)
+            m_marginMs = std::min(2.0 * m_marginMs, m_refreshPeriod * 500.0);
+        else
+            m_marginMs = std::max(m_marginMs * kMarginDecay, kMinMarginMs);
+        m_lastVblank = now;
+        m_hasVblank = true;
+    }
+}
+
+void FramePacing::readQueries()
+{
+    for (PendingFrame &frame : m_pending) {
+        if (!frame.issued)
+            continue;
+        GLint available = 0;
+        glGetQueryObjectiv(frame.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint64 gpuNs = 0;
+        glGetQueryObjectui64v(frame.query, GL_QUERY_RESULT, &gpuNs);
+        frame.issued = false;
+        if (!frame.hasInput)
+            continue;
+        const Clock::time_point done(std::chrono::duration_cast<Clock::duration>(
+            std::chrono::nanoseconds(static_cast<int64_t>(gpuNs) + m_gpuToClockNs)));
+        const double latency = milliseconds(done - frame.input);
+        if (latency >= 0.0)
+            m_latencies[m_latencyCount++ % kHistory] = latency;
+    }
+}
+
+void FramePacing::printStats() const
+{
+    const size_t frames = std::min(m_frameCount, kHistory);
+    std::cout << "present " << presentModeName(m_mode) << (m_deadline ? " with frame deadline" : "") << std::endl;
+    if (frames > 0) {
+        double sum = 0.0, sumSquares = 0.0;
+        int late = 0;
+        for (size_t i = 0; i < frames; i++) {
+            sum += m_frameTimes[i];
+            sumSquares += m_frameTimes[i] * m_frameTimes[i];
+            if (m_frameTimes[i] > kLateFrame * m_refreshPeriod * 1000.0)
+                late++;
+        }
+        const double mean = sum / frames;
+        const double deviation = std::sqrt(std::max(sumSquares / frames - mean * mean, 0.0));
+        std::cout << "frame time over " << frames << " frames: " << mean << " ms mean, " << deviation << " ms std dev, "
+                  << percentile(m_frameTimes, frames, 0.99) << " ms p99";
+        if (m_mode == PresentMode::Vsync || m_mode == PresentMode::Adaptive)
+            std::cout << ", " << late << " missed a vertical blank";
+        std::cout << std::endl;
+    }
+    if (m_deadline && m_workCount > 0) {
+        std::cout << "frame cost " << percentile(m_workTimes, std::min(m_workCount, kHistory), 0.95)
+                  << " ms p95, deadline margin " << m_marginMs << " ms" << std::endl;
+    }
+    const size_t latencies = std::min(m_latencyCount, kHistory);
+    if (latencies > 0) {
+        double sum = 0.0;
+        for (size_t i = 0; i < latencies; i++)
+            sum += m_latencies[i];
+        std::cout << "input to present latency over " << latencies << " inputs: " << sum / latencies << " ms mean, "
+                  << percentile(m_latencies, latencies, 0.99) << " ms p99" << std::endl;
+    }
+}
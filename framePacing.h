@@ -0,0 +1,87 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "frameLimiter.h"
+
+// How the frames reach the screen:
+// vsync     waits for the vertical blank, no tearing (swap interval 1)
+// adaptive  like vsync, but a late frame is shown at once with a tear instead of waiting one
+//           more refresh (swap interval -1, needs WGL/GLX_EXT_swap_control_tear)
+// uncapped  no wait at all (swap interval 0), lowest latency, tears
+// capped    no vsync, the frame rate is capped by a FrameLimiter
+enum class PresentMode { Vsync, Adaptive, Uncapped, Capped };
+
+const char *presentModeName(PresentMode mode);
+bool parsePresentMode(const std::string &name, PresentMode &mode);
+
+// Presentation of the frames and their statistics: frame time variance, and the latency from
+// an input to the completion of the frame that shows it, measured with a GL_TIMESTAMP query
+// issued after the swap (the scan-out adds up to one refresh to it).
+// With the deadline strategy (vsync modes), the CPU waits for each swap to complete and starts
+// the next frame as late as possible: at the next vertical blank minus the recent worst frame
+// cost and a margin, so that the input read at its start is as fresh as it can be. A frame
+// missing its deadline anyway widens the margin.
+class FramePacing {
+public:
+    // Sets the swap interval of the current context of window, refreshRate is the monitor's
+    // (Hz). Returns the mode applied: adaptive falls back to vsync without the extension.
+    // Without a window (headless), present() has nothing to swap and the mode is uncapped.
+    PresentMode init(GLFWwindow *window, PresentMode mode, bool deadline, double refreshRate);
+
+    // Marks the start of a frame, after waiting for its deadline.
+    void beginFrame();
+    // The loop skipped frames (e.g. minimized): the next interval is not a frame time.
+    void idle();
+    // An input that the next frame will show
+    void inputEvent();
+    // Swaps the buffers of the window and records the frame.
+    void present();
+
+    void printStats() const;
+
+private:
+    typedef FrameLimiter::Clock Clock;
+    static const int kNumQueries = 4;    // timestamp queries in flight
+    static const size_t kHistory = 240;  // frames in the statistics
+
+    struct PendingFrame {
+        GLuint query = 0;
+        bool issued = false;
+        bool hasInput = false;
+        Clock::time_point input;
+    };
+
+    void calibrate();
+    void readQueries();
+
+    GLFWwindow *m_window = nullptr;
+    PresentMode m_mode = PresentMode::Vsync;
+    bool m_deadline = false;
+    double m_refreshPeriod = 1.0 / 60.0;          // seconds
+    FrameLimiter m_waiter;
+
+    Clock::time_point m_frameStart, m_lastFrameStart, m_lastVblank;
+    bool m_hasLastFrame = false, m_hasVblank = false;
+    std::vector<double> m_frameTimes;             // ms, ring of kHistory
+    std::vector<double> m_workTimes;              // ms, CPU and GPU time of the deadline frames
+    size_t m_frameCount = 0, m_workCount = 0;
+    double m_marginMs = 1.0;
+
+    bool m_hasInput = false;                      // an input waits for its frame
+    Clock::time_point m_input;
+    PendingFrame m_pending[kNumQueries];
+    int m_nextQuery = 0;
+    int64_t m_gpuToClockNs = 0;                   // GL_TIMESTAMP to Clock offset
+    std::vector<double> m_latencies;              // ms, ring of kHistory
+    size_t m_latencyCount = 0;
+};
+
+#endif // FRAME_PACING_H
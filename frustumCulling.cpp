@@ -0,0 +1,240 @@
+#include "frustumCulling.h"
+
+#include <algorithm>
+#include <cmath>
+
+// The AVX2 loop is compiled for AVX2 and FMA on its own and only run on the CPUs that have them
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FRUSTUM_CULLING_AVX2 __attribute__((target("avx2,fma")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+#define FRUSTUM_CULLING_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRUSTUM_CULLING_SSE2
+#endif
+
+namespace {
+
+const size_t kSimdWidth = 8;        // padding, a multiple of every vector width used below
+const float kNeverInside = -1e30f;  // radius of the padding spheres
+
+// Appends base + i for the set bits i of mask
+inline void appendMask(int mask, size_t base, int width, std::vector<uint32_t> &visible)
+{
+    for (int i = 0; i < width; i++) {
+        if (mask & (1 << i))
+            visible.push_back(static_cast<uint32_t>(base + i));
+    }
+}
+
+#ifdef FRUSTUM_CULLING_AVX2
+bool hasAvx2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0, fma = (info[2] & (1 << 12)) != 0;
+    if (!osxsave || !fma || (_xgetbv(0) & 6) != 6) // the OS saves the ymm registers
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+FRUSTUM_CULLING_AVX2
+void cullAvx2(size_t begin, size_t end, const float *x, const float *y, const float *z, const float *r,
+              const float *planes, std::vector<uint32_t> &visible)
+{
+    __m256 a[6], b[6], c[6], d[6];
+    for (int p = 0; p < 6; p++) {
+        a[p] = _mm256_set1_ps(planes[4 * p]);
+        b[p] = _mm256_set1_ps(planes[4 * p + 1]);
+        c[p] = _mm256_set1_ps(planes[4 * p + 2]);
+        d[p] = _mm256_set1_ps(planes[4 * p + 3]);
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    for (size_t i = begin; i < end; i += 8) {
+        const __m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+        const __m256 minusR = _mm256_sub_ps(zero, _mm256_loadu_ps(r + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            const __m256 dist = _mm256_fmadd_ps(a[p], vx, _mm256_fmadd_ps(b[p], vy, _mm256_fmadd_ps(c[p], vz, d[p])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, minusR, _CMP_GE_OQ));
+        }
+        const int mask = _mm256_movemask_ps(inside);
+        if (mask != 0)
+            appendMask(mask, i, 8, visible);
+    }
+}
+#endif
+
+#ifdef FRUSTUM_CULLING_SSE2
+void cullSse2(size_t begin, size_t end, const float *x, const float *y, const float *z, const float *r,
+              const float *planes, std::vector<uint32_t> &visible)
+{
+    __m128 a[6], b[6], c[6], d[6];
+    for (int p = 0; p < 6; p++) {
+        a[p] = _mm_set1_ps(planes[4 * p]);
+        b[p] = _mm_set1_ps(planes[4 * p + 1]);
+        c[p] = _mm_set1_ps(planes[4 * p + 2]);
+        d[p] = _mm_set1_ps(planes[4 * p + 3]);
+    }
+    const __m128 zero = _mm_setzero_ps();
+    for (size_t i = begin; i < end; i += 4) {
+        const __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+        const __m128 minusR = _mm_sub_ps(zero, _mm_loadu_ps(r + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++) {
+            const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[p], vx), _mm_mul_ps(b[p], vy)),
+                                           _mm_add_ps(_mm_mul_ps(c[p], vz), d[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, minusR));
+        }
+        const int mask = _mm_movemask_ps(inside);
+        if (mask != 0)
+            appendMask(mask, i, 4, visible);
+    }
+}
+#endif
+
+} // namespace
+
+void extractFrustumPlanes(const glm::mat4 &viewProjection, bool zeroToOneDepth, glm::vec4 planes[6])
+{
+    // Gribb and Hartmann: combinations of the rows of the matrix
+    const glm::mat4 &m = viewProjection;
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    planes[0] = rows[3] + rows[0];                             // left
+    planes[1] = rows[3] - rows[0];                             // right
+    planes[2] = rows[3] + rows[1];                             // bottom
+    planes[3] = rows[3] - rows[1];                             // top
+    planes[4] = zeroToOneDepth ? rows[2] : rows[3] + rows[2];  // depth 0 (the far plane with reverse-Z)
+    planes[5] = rows[3] - rows[2];                             // depth 1
+    for (int i = 0; i < 6; i++) {
+        const float length = glm::length(glm::vec3(planes[i]));
+        planes[i] = length > 1e-6f ? planes[i] / length : glm::vec4(0.f, 0.f, 0.f, 1.f);
+    }
+}
+
+FrustumCulling::~FrustumCulling()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &worker : m_workers)
+        worker.join();
+}
+
+void FrustumCulling::add(const glm::vec3 &center, float radius)
+{
+    // drop the padding of the last cull
+    m_x.resize(m_count);
+    m_y.resize(m_count);
+    m_z.resize(m_count);
+    m_radius.resize(m_count);
+    m_x.push_back(center.x);
+    m_y.push_back(center.y);
+    m_z.push_back(center.z);
+    m_radius.push_back(radius);
+    m_count++;
+}
+
+void FrustumCulling::cullRange(size_t begin, size_t end, const float *planes, std::vector<uint32_t> &visible) const
+{
+    const float *x = m_x.data(), *y = m_y.data(), *z = m_z.data(), *r = m_radius.data();
+#ifdef FRUSTUM_CULLING_AVX2
+    static const bool avx2 = hasAvx2();
+    if (avx2) {
+        cullAvx2(begin, end, x, y, z, r, planes, visible);
+        return;
+    }
+#endif
+#ifdef FRUSTUM_CULLING_SSE2
+    cullSse2(begin, end, x, y, z, r, planes, visible);
+#else
+    for (size_t i = begin; i < end; i++) {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++)
+            inside = planes[4 * p] * x[i] + planes[4 * p + 1] * y[i] + planes[4 * p + 2] * z[i] + planes[4 * p + 3] >= -r[i];
+        if (inside)
+            visible.push_back(static_cast<uint32_t>(i));
+    }
+#endif
+}
+
+const std::vector<uint32_t> &FrustumCulling::cull(const glm::vec4 planes[6])
+{
+    const size_t padded = (m_count + kSimdWidth - 1) / kSimdWidth * kSimdWidth;
+    m_x.resize(padded, 0.f);
+    m_y.resize(padded, 0.f);
+    m_z.resize(padded, 0.f);
+    m_radius.resize(padded, kNeverInside);
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 4; j++)
+            m_planes[4 * i + j] = planes[i][j];
+    }
+
+    m_visible.clear();
+    const size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (padded < kParallelThreshold || numThreads == 1) {
+        cullRange(0, padded, m_planes, m_visible);
+        return m_visible;
+    }
+    if (m_workers.empty()) {
+        m_threadVisible.resize(numThreads);
+        for (size_t t = 1; t < numThreads; t++)
+            m_workers.emplace_back(&FrustumCulling::run, this, t, m_generation);
+    }
+    // chunks of whole vectors, concatenated in order
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_padded = padded;
+        m_chunk = (padded / kSimdWidth + m_threadVisible.size() - 1) / m_threadVisible.size() * kSimdWidth;
+        m_pending = m_workers.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+    cullChunk(0);
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_pending == 0; });
+    }
+    for (const std::vector<uint32_t> &visible : m_threadVisible)
+        m_visible.insert(m_visible.end(), visible.begin(), visible.end());
+    return m_visible;
+}
+
+void FrustumCulling::cullChunk(size_t index)
+{
+    const size_t begin = std::min(index * m_chunk, m_padded), end = std::min(begin + m_chunk, m_padded);
+    m_threadVisible[index].clear();
+    cullRange(begin, end, m_planes, m_threadVisible[index]);
+}
+
+// Worker culling the chunk index of every new generation
+void FrustumCulling::run(size_t index, uint64_t generation)
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_quit || m_generation != generation; });
+            if (m_quit)
+                return;
+            generation = m_generation;
+        }
+        cullChunk(index);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_pending == 0)
+            m_done.notify_one();
+    }
+}
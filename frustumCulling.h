@@ -0,0 +1,58 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Planes (a, b, c, d) of the view frustum of a view-projection matrix, facing inwards and
+// normalized, so that a.x + b.y + c.z + d is the signed distance of (x, y, z) to the plane.
+// zeroToOneDepth tells the clip space depth range; a plane at infinity (reverse-Z) never culls.
+void extractFrustumPlanes(const glm::mat4 &viewProjection, bool zeroToOneDepth, glm::vec4 planes[6]);
+
+// Frustum culling of bounding spheres. The spheres are stored as a structure of arrays, so
+// that 8 of them (AVX2, when the CPU has it) or 4 (SSE2) are tested against each plane with
+// a few vector instructions; the sets larger than kParallelThreshold are split across a pool
+// of worker threads, started on first use. The result is a compact list of indices for the
+// renderer.
+class FrustumCulling {
+public:
+    static const size_t kParallelThreshold = 65536;
+
+    ~FrustumCulling();
+
+    inline void clear() { m_count = 0; }
+    // Adds a sphere, its index is the number of spheres added before it
+    void add(const glm::vec3 &center, float radius);
+    inline size_t size() const { return m_count; }
+
+    // Indices of the spheres at least partly inside the six planes, in increasing order
+    const std::vector<uint32_t> &cull(const glm::vec4 planes[6]);
+
+private:
+    void cullRange(size_t begin, size_t end, const float *planes, std::vector<uint32_t> &visible) const;
+    void cullChunk(size_t index);
+    void run(size_t index, uint64_t generation);
+
+    std::vector<float> m_x, m_y, m_z, m_radius; // padded to a multiple of the SIMD width by cull()
+    size_t m_count = 0;
+    std::vector<uint32_t> m_visible;
+    std::vector<std::vector<uint32_t>> m_threadVisible; // one per chunk
+
+    // the workers cull the chunks 1 to n of a generation, the calling thread the chunk 0
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake, m_done;
+    uint64_t m_generation = 0;
+    size_t m_pending = 0;       // chunks of the current generation not culled yet
+    bool m_quit = false;
+    float m_planes[24];
+    size_t m_padded = 0, m_chunk = 0;
+};
+
+#endif // FRUSTUM_CULLING_H
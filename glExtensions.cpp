@@ -0,0 +1,43 @@
+#include "glExtensions.h"
+
+#include <cstring>
+
+PFNGLGETPROGRAMBINARYPROC ext_glGetProgramBinary = nullptr;
+PFNGLPROGRAMBINARYPROC ext_glProgramBinary = nullptr;
+PFNGLPROGRAMPARAMETERIPROC ext_glProgramParameteri = nullptr;
+PFNGLCLIPCONTROLPROC ext_glClipControl = nullptr;
+PFNGLBUFFERSTORAGEPROC ext_glBufferStorage = nullptr;
+
+namespace {
+
+bool hasVersion(int major, int minor)
+{
+    return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+} // namespace
+
+bool hasGLExtension(const char *name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char *ext = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (ext != nullptr && std::strcmp(ext, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+void loadGLExtensions(GLADloadproc load)
+{
+    if (hasVersion(4, 1) || hasGLExtension("GL_ARB_get_program_binary")) {
+        ext_glGetProgramBinary = reinterpret_cast<PFNGLGETPROGRAMBINARYPROC>(load("glGetProgramBinary"));
+        ext_glProgramBinary = reinterpret_cast<PFNGLPROGRAMBINARYPROC>(load("glProgramBinary"));
+        ext_glProgramParameteri = reinterpret_cast<PFNGLPROGRAMPARAMETERIPROC>(load("glProgramParameteri"));
+    }
+    if (hasVersion(4, 5) || hasGLExtension("GL_ARB_clip_control"))
+        ext_glClipControl = reinterpret_cast<PFNGLCLIPCONTROLPROC>(load("glClipControl"));
+    if (hasVersion(4, 4) || hasGLExtension("GL_ARB_buffer_storage"))
+        ext_glBufferStorage = reinterpret_cast<PFNGLBUFFERSTORAGEPROC>(load("glBufferStorage"));
+}
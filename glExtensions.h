@@ -0,0 +1,45 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+// OpenGL entry points beyond the 3.3 core profile generated in glad/, resolved at runtime
+// when the driver has them (core in a later version, or through the ARB extension). A null
+// pointer means the feature is missing and the caller keeps its 3.3 path.
+
+// GL 4.1, ARB_get_program_binary
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+extern PFNGLGETPROGRAMBINARYPROC ext_glGetProgramBinary;
+extern PFNGLPROGRAMBINARYPROC ext_glProgramBinary;
+extern PFNGLPROGRAMPARAMETERIPROC ext_glProgramParameteri;
+#define glGetProgramBinary ext_glGetProgramBinary
+#define glProgramBinary ext_glProgramBinary
+#define glProgramParameteri ext_glProgramParameteri
+
+// GL 4.5, ARB_clip_control
+#define GL_LOWER_LEFT 0x8CA1
+#define GL_NEGATIVE_ONE_TO_ONE 0x935E
+#define GL_ZERO_TO_ONE 0x935F
+typedef void (APIENTRYP PFNGLCLIPCONTROLPROC)(GLenum origin, GLenum depth);
+extern PFNGLCLIPCONTROLPROC ext_glClipControl;
+#define glClipControl ext_glClipControl
+
+// GL 4.4, ARB_buffer_storage
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+extern PFNGLBUFFERSTORAGEPROC ext_glBufferStorage;
+#define glBufferStorage ext_glBufferStorage
+
+// Whether the context advertises an extension, e.g. "GL_ARB_get_program_binary"
+bool hasGLExtension(const char *name);
+// Resolves the entry points above, once the context is current and glad is loaded.
+void loadGLExtensions(GLADloadproc load);
+
+#endif // GL_EXTENSIONS_H
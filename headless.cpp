@@ -0,0 +1,180 @@
+#include "headless.h"
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef HAVE_EGL
+#define EGL_NO_X11
+#define MESA_EGL_NO_X11_HEADERS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+HeadlessContext::~HeadlessContext()
+{
+    destroy();
+}
+
+#ifdef HAVE_EGL
+
+namespace {
+
+bool hasClientExtension(const char *name)
+{
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (extensions == nullptr)
+        return false;
+    const std::string list = std::string(" ") + extensions + " ";
+    return list.find(std::string(" ") + name + " ") != std::string::npos;
+}
+
+// Display of the surfaceless platform, or of the first device
+EGLDisplay openDisplay()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay == nullptr)
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (hasClientExtension("EGL_MESA_platform_surfaceless")) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display != EGL_NO_DISPLAY)
+            return display;
+    }
+    PFNEGLQUERYDEVICESEXTPROC queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+    if (queryDevices != nullptr && hasClientExtension("EGL_EXT_platform_device")) {
+        EGLDeviceEXT device;
+        EGLint numDevices = 0;
+        if (queryDevices(1, &device, &numDevices) && numDevices > 0)
+            return getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+} // namespace
+
+bool HeadlessContext::createContext()
+{
+    EGLDisplay display = openDisplay();
+    EGLint major = 0, minor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        std::cerr << "ERROR: no EGL display for headless rendering" << std::endl;
+        return false;
+    }
+    m_display = display;
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "ERROR: EGL " << major << "." << minor << " without desktop OpenGL" << std::endl;
+        return false;
+    }
+    const EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config = nullptr;
+    EGLint numConfigs = 0;
+    eglChooseConfig(display, configAttributes, &config, 1, &numConfigs); // none: EGL_KHR_no_config_context
+    const EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+    EGLContext context = eglCreateContext(display, numConfigs > 0 ? config : nullptr, EGL_NO_CONTEXT, contextAttributes);
+    if (context == EGL_NO_CONTEXT) {
+        std::cerr << "ERROR: failed to create a headless OpenGL 3.3 core context (EGL error 0x" << std::hex << eglGetError()
+                  << std::dec << ")" << std::endl;
+        return false;
+    }
+    m_context = context;
+    // no surface at all: EGL_KHR_surfaceless_context
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        std::cerr << "ERROR: the headless context cannot be made current without a surface" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void *HeadlessContext::getProcAddress(const char *name)
+{
+    return reinterpret_cast<void *>(eglGetProcAddress(name));
+}
+
+void HeadlessContext::destroy()
+{
+    if (m_context != nullptr) {
+        if (m_fbo != 0) {
+            glDeleteFramebuffers(1, &m_fbo);
+            glDeleteRenderbuffers(1, &m_colorRb);
+            glDeleteRenderbuffers(1, &m_depthRb);
+            m_fbo = 0;
+        }
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(m_display, m_context);
+        m_context = nullptr;
+    }
+    if (m_display != nullptr) {
+        eglTerminate(m_display);
+        m_display = nullptr;
+    }
+}
+
+#else
+
+bool HeadlessContext::createContext()
+{
+    std::cerr << "ERROR: headless rendering needs EGL, not found at build time" << std::endl;
+    return false;
+}
+
+void *HeadlessContext::getProcAddress(const char *)
+{
+    return nullptr;
+}
+
+void HeadlessContext::destroy()
+{
+}
+
+#endif // HAVE_EGL
+
+bool HeadlessContext::init(int width, int height)
+{
+    if (!createContext())
+        return false;
+    if (!gladLoadGLLoader(getProcAddress)) {
+        std::cerr << "ERROR: Failed to initialize OpenGL context" << std::endl;
+        return false;
+    }
+    std::cout << "headless: " << glGetString(GL_RENDERER) << ", OpenGL " << glGetString(GL_VERSION) << std::endl;
+
+    m_width = width;
+    m_height = height;
+    glGenRenderbuffers(1, &m_colorRb);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colorRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &m_depthRb);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &m_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorRb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthRb);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "ERROR: incomplete headless framebuffer" << std::endl;
+        return false;
+    }
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+bool HeadlessContext::savePPM(const std::string &filename) const
+{
+    std::vector<unsigned char> pixels(static_cast<size_t>(m_width) * m_height * 3);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+    std::ofstream file(filename.c_str(), std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: cannot write " << filename << std::endl;
+        return false;
+    }
+    file << "P6\n" << m_width << " " << m_height << "\n255\n";
+    const size_t rowSize = static_cast<size_t>(m_width) * 3;
+    for (int y = m_height - 1; y >= 0; y--)
+        file.write(reinterpret_cast<const char *>(pixels.data() + y * rowSize), rowSize);
+    return static_cast<bool>(file);
+}
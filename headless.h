@@ -0,0 +1,40 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <string>
+
+#include <glad/glad.h>
+
+// OpenGL 3.3 core context without a window or a display server, for render nodes and batch
+// runs. It is created through EGL, on the surfaceless platform of Mesa
+// (EGL_MESA_platform_surfaceless, the GPU or llvmpipe with LIBGL_ALWAYS_SOFTWARE=1), or else
+// on the first EGL device (EGL_EXT_platform_device, e.g. the NVIDIA driver). Without a
+// default framebuffer, the frames go to a framebuffer object of the requested size.
+// Built with EGL only (HAVE_EGL, see CMakeLists.txt).
+class HeadlessContext {
+public:
+    ~HeadlessContext();
+
+    // Creates the context, makes it current and loads glad, then the framebuffer of the frames.
+    bool init(int width, int height);
+    // Entry point lookup, for loadGLExtensions
+    static void *getProcAddress(const char *name);
+
+    inline GLuint getFramebuffer() const { return m_fbo; }
+    inline int getWidth() const { return m_width; }
+    inline int getHeight() const { return m_height; }
+
+    // Writes the framebuffer as a binary PPM, top row first.
+    bool savePPM(const std::string &filename) const;
+    void destroy();
+
+private:
+    bool createContext();
+
+    void *m_display = nullptr; // EGLDisplay
+    void *m_context = nullptr; // EGLContext
+    GLuint m_fbo = 0, m_colorRb = 0, m_depthRb = 0;
+    int m_width = 0, m_height = 0;
+};
+
+#endif // HEADLESS_H
@@ -0,0 +1,208 @@
+#include "imageDecoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "assetPack.h"
+#include "parallelJpeg.h"
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+namespace {
+
+// Default backend, handles every format stb_image knows. stb_image allocates its own
+// output, so this one pays a copy into the caller's buffer.
+class StbImageDecoder : public ImageDecoder {
+public:
+    const char *name() const override { return "stb"; }
+    bool supports(ImageFormat) const override { return true; }
+    bool readInfo(const unsigned char *data, size_t size, ImageInfo &info) const override {
+        return stbi_info_from_memory(data, static_cast<int>(size), &info.width, &info.height, &info.numComponents) != 0;
+    }
+    bool decode(const unsigned char *data, size_t size, const ImageInfo &info,
+                unsigned char *dst, size_t stride) const override {
+        int width, height, numComponents;
+        unsigned char *pixels = stbi_load_from_memory(data, static_cast<int>(size), &width, &height, &numComponents, info.numComponents);
+        if (pixels == nullptr)
+            return false;
+        for (int y = 0; y < height; y++)
+            std::memcpy(dst + y * stride, pixels + y * info.rowSize(), info.rowSize());
+        stbi_image_free(pixels);
+        return true;
+    }
+};
+
+// Baseline JPEGs decoded on all cores, see parallelJpeg.h
+class ParallelJpegDecoder : public ImageDecoder {
+public:
+    const char *name() const override { return "parallel-jpeg"; }
+    bool supports(ImageFormat format) const override { return format == ImageFormat::Jpeg; }
+    bool readInfo(const unsigned char *data, size_t size, ImageInfo &info) const override {
+        return readJpegInfo(data, size, info.width, info.height, info.numComponents);
+    }
+    bool decode(const unsigned char *data, size_t size, const ImageInfo &,
+                unsigned char *dst, size_t stride) const override {
+        return decodeJpegParallel(data, size, dst, stride);
+    }
+};
+
+#ifdef HAVE_TURBOJPEG
+// SIMD accelerated JPEG decoding through libjpeg-turbo, writing with the caller's pitch.
+class TurboJpegDecoder : public ImageDecoder {
+public:
+    const char *name() const override { return "turbojpeg"; }
+    bool supports(ImageFormat format) const override { return format == ImageFormat::Jpeg; }
+    bool readInfo(const unsigned char *data, size_t size, ImageInfo &info) const override {
+        tjhandle handle = tjInitDecompress();
+        if (handle == nullptr)
+            return false;
+        int subsampling, colorspace;
+        const int status = tjDecompressHeader3(handle, const_cast<unsigned char *>(data), static_cast<unsigned long>(size),
+                                               &info.width, &info.height, &subsampling, &colorspace);
+        tjDestroy(handle);
+        info.numComponents = colorspace == TJCS_GRAY ? 1 : 3;
+        return status == 0;
+    }
+    bool decode(const unsigned char *data, size_t size, const ImageInfo &info,
+                unsigned char *dst, size_t stride) const override {
+        tjhandle handle = tjInitDecompress();
+        if (handle == nullptr)
+            return false;
+        const int status = tjDecompress2(handle, const_cast<unsigned char *>(data), static_cast<unsigned long>(size),
+                                         dst, info.width, static_cast<int>(stride), info.height,
+                                         info.numComponents == 1 ? TJPF_GRAY : TJPF_RGB, 0);
+        if (status != 0)
+            std::cerr << "ERROR: turbojpeg: " << tjGetErrorStr2(handle) << std::endl;
+        tjDestroy(handle);
+        return status == 0;
+    }
+};
+#endif
+
+struct RegisteredDecoder {
+    int priority;
+    std::unique_ptr<ImageDecoder> decoder;
+};
+
+std::vector<RegisteredDecoder> &registry()
+{
+    static std::vector<RegisteredDecoder> decoders;
+    static bool initialized = false;
+    if (!initialized) {
+        initialized = true;
+        decoders.push_back({0, std::unique_ptr<ImageDecoder>(new StbImageDecoder())});
+        decoders.push_back({20, std::unique_ptr<ImageDecoder>(new ParallelJpegDecoder())});
+#ifdef HAVE_TURBOJPEG
+        decoders.push_back({30, std::unique_ptr<ImageDecoder>(new TurboJpegDecoder())});
+#endif
+        std::stable_sort(decoders.begin(), decoders.end(), [](const RegisteredDecoder &a, const RegisteredDecoder &b) {
+            return a.priority > b.priority;
+        });
+    }
+    return decoders;
+}
+
+std::map<ImageFormat, std::string> &preferredDecoders()
+{
+    static std::map<ImageFormat, std::string> preferred;
+    static bool initialized = false;
+    if (!initialized) {
+        initialized = true;
+        if (const char *name = std::getenv("TP_JPEG_DECODER"))
+            preferred[ImageFormat::Jpeg] = name;
+    }
+    return preferred;
+}
+
+} // namespace
+
+ImageFormat detectImageFormat(const unsigned char *data, size_t size)
+{
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) return ImageFormat::Jpeg;
+    if (size >= 8 && std::memcmp(data, "\x89PNG\r\n\x1a\n", 8) == 0) return ImageFormat::Png;
+    if (size >= 2 && data[0] == 'B' && data[1] == 'M') return ImageFormat::Bmp;
+    if (size >= 2 && data[0] == '#' && data[1] == '?') return ImageFormat::Hdr;
+    return size > 0 ? ImageFormat::Other : ImageFormat::Unknown;
+}
+
+void registerImageDecoder(std::unique_ptr<ImageDecoder> decoder, int priority)
+{
+    std::vector<RegisteredDecoder> &decoders = registry();
+    auto it = std::find_if(decoders.begin(), decoders.end(), [priority](const RegisteredDecoder &d) {
+        return d.priority < priority;
+    });
+    decoders.insert(it, RegisteredDecoder{priority, std::move(decoder)});
+}
+
+void setPreferredImageDecoder(ImageFormat format, const std::string &name)
+{
+    preferredDecoders()[format] = name;
+}
+
+const ImageDecoder *findImageDecoder(const unsigned char *data, size_t size, ImageInfo &info,
+                                     const ImageDecoder *after)
+{
+    const ImageFormat format = detectImageFormat(data, size);
+    if (format == ImageFormat::Unknown)
+        return nullptr;
+    std::vector<const ImageDecoder *> candidates;
+    for (const RegisteredDecoder &d : registry())
+        if (d.decoder->supports(format))
+            candidates.push_back(d.decoder.get());
+    auto preferred = preferredDecoders().find(format);
+    if (preferred != preferredDecoders().end()) {
+        std::stable_partition(candidates.begin(), candidates.end(), [&](const ImageDecoder *d) {
+            return preferred->second == d->name();
+        });
+    }
+    bool skipping = after != nullptr;
+    for (const ImageDecoder *decoder : candidates) {
+        if (skipping) {
+            skipping = decoder != after;
+            continue;
+        }
+        ImageInfo candidateInfo;
+        if (decoder->readInfo(data, size, candidateInfo)) {
+            info = candidateInfo;
+            info.format = format;
+            return decoder;
+        }
+    }
+    return nullptr;
+}
+
+bool readBinaryFile(const std::string &filename, std::vector<unsigned char> &data)
+{
+    std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+        return false;
+    const std::streamsize size = file.tellg();
+    if (size < 0)
+        return false;
+    data.resize(static_cast<size_t>(size));
+    file.seekg(0);
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(data.data()), size));
+}
+
+bool decodeImageFile(const std::string &filename, ImageInfo &info, std::vector<unsigned char> &pixels)
+{
+    std::vector<unsigned char> storage;
+    AssetView data;
+    if (!loadAsset(filename, data, storage))
+        return false;
+    for (const ImageDecoder *decoder = findImageDecoder(data.data, data.size, info); decoder != nullptr;
+         decoder = findImageDecoder(data.data, data.size, info, decoder)) {
+        pixels.resize(info.rowSize() * info.height);
+        if (decoder->decode(data.data, data.size, info, pixels.data(), info.rowSize()))
+            return true;
+    }
+    return false;
+}
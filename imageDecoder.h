@@ -0,0 +1,56 @@
+#ifndef IMAGE_DECODER_H
+#define IMAGE_DECODER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class ImageFormat { Unknown, Jpeg, Png, Bmp, Tga, Hdr, Other };
+
+struct ImageInfo {
+    int width = 0;
+    int height = 0;
+    int numComponents = 0; // 1 grey, 2 grey+alpha, 3 RGB, 4 RGBA
+    ImageFormat format = ImageFormat::Unknown;
+    inline size_t rowSize() const { return static_cast<size_t>(width) * numComponents; }
+};
+
+// An image decoder backend. Backends decode an encoded image held in memory into a
+// buffer owned by the caller (e.g. a mapped pixel unpack buffer), so that pixels are
+// written once, straight into the upload memory.
+class ImageDecoder {
+public:
+    virtual ~ImageDecoder() {}
+    virtual const char *name() const = 0;
+    virtual bool supports(ImageFormat format) const = 0;
+    // Reads the header only. Returns false if this backend cannot decode the image.
+    virtual bool readInfo(const unsigned char *data, size_t size, ImageInfo &info) const = 0;
+    // Decodes into dst, rows are stride bytes apart (stride >= info.rowSize()).
+    virtual bool decode(const unsigned char *data, size_t size, const ImageInfo &info,
+                        unsigned char *dst, size_t stride) const = 0;
+};
+
+// Guesses the format from the magic bytes.
+ImageFormat detectImageFormat(const unsigned char *data, size_t size);
+
+// Registered backends are tried in priority order (highest first) for a given format.
+// Built-in backends: "turbojpeg" (JPEG, 30, only with HAVE_TURBOJPEG), "parallel-jpeg"
+// (JPEG, 20) and "stb" (every format, 0). The TP_JPEG_DECODER environment variable
+// moves the named backend in front of the others for JPEG files.
+void registerImageDecoder(std::unique_ptr<ImageDecoder> decoder, int priority);
+void setPreferredImageDecoder(ImageFormat format, const std::string &name);
+
+// Finds the first backend able to decode this image, and fills info. Returns nullptr if none.
+// A backend may accept the header and still fail to decode (e.g. parallel-jpeg on a truncated
+// scan): passing it as after returns the next candidate, down to stb.
+const ImageDecoder *findImageDecoder(const unsigned char *data, size_t size, ImageInfo &info,
+                                     const ImageDecoder *after = nullptr);
+
+// Reads a whole binary file in memory.
+bool readBinaryFile(const std::string &filename, std::vector<unsigned char> &data);
+
+// Convenience helper decoding a file into a tightly packed CPU buffer.
+bool decodeImageFile(const std::string &filename, ImageInfo &info, std::vector<unsigned char> &pixels);
+
+#endif // IMAGE_DECODER_H
@@ -6,6 +6,8 @@
 #include <string>
 #include <cmath>
 #include <memory>
+#include <algorithm>
+#include <stdexcept>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -13,8 +15,27 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "assetPack.h"
+#include "assetResolver.h"
+#include "atmosphere.h"
+#include "cameraBuffer.h"
+#include "clusteredLights.h"
+#include "dynamicResolution.h"
+#include "frameCapture.h"
+#include "frameLimiter.h"
+#include "framePacing.h"
+#include "frustumCulling.h"
+#include "glExtensions.h"
+#include "headless.h"
+#include "imageDecoder.h"
+#include "occlusionCulling.h"
+#include "programCache.h"
+#include "shaderPermutations.h"
+#include "shaderReloader.h"
+#include "simulationThread.h"
+#include "skyCubemap.h"
+#include "textureResidency.h"
+#include "virtualTexture.h"
 
 // constants
 const static float kSizeSun = 1;
@@ -28,8 +49,119 @@ const static float cameraSpeed = 0.1f;
 // Window parameters
 GLFWwindow *g_window = nullptr;
 
+// Without a window (--headless): an EGL context renders --frames frames of --size WIDTH HEIGHT
+// into a framebuffer object, and the last one is saved to --output (PPM) when given
+bool g_headless = false;
+HeadlessContext g_headlessContext;
+int g_headlessWidth = 1024, g_headlessHeight = 768;
+int g_headlessFrames = 1;
+std::string g_outputFile;
+
+// The orbits are computed on their own thread, --simulation-rate steps per second, and the
+// frames interpolate between the two latest steps
+SimulationThread g_simulation;
+double g_simulationRate = 120.0;
+SimulationState g_simulationState;
+enum { kTransformEarth, kTransformMoon, kTransformEarthOrbit, kNumTransforms }; // g_simulationState.transforms
+void simulate(const double currentTimeInSec, SimulationState &state);
+
+// Frame loop: the frame rate is capped with --max-fps (0: uncapped) and with --background-fps
+// while the window is not focused; minimized, it sleeps until an event. P pauses the animation,
+// and with --on-demand a paused scene is only redrawn after input or a window event.
+FrameLimiter g_frameLimiter;
+double g_maxFps = 0.0;
+double g_backgroundFps = 10.0;
+bool g_onDemand = false;
+bool g_paused = false;
+bool g_redraw = true; // something changed the image since the last frame
+const static double kIdleWaitSeconds = 0.5; // wake up regularly anyway, e.g. for the shader reloader
+
+// Presentation (--present vsync, adaptive, uncapped or capped at --max-fps, by default the
+// refresh rate), optionally with --frame-deadline; L prints the frame and latency statistics
+FramePacing g_framePacing;
+PresentMode g_presentMode = PresentMode::Vsync;
+bool g_frameDeadline = false;
+
+// Frames read back without stalling and written by a background thread: all of them to the
+// files of --capture PATTERN (e.g. capture/%05d.png), or one with F12
+FrameCapture g_frameCapture;
+std::string g_capturePattern;
+
+// Assets are read from this pack (built by the assetPack target) before the files, set with --asset-pack
+std::string g_assetPackFile;
+
+// Texture assets: quality tier forced with --texture-tier, or picked to load within --startup-target-ms
+AssetResolver g_assets("../media/");
+bool g_forceTextureTier = false;
+TextureTier g_textureTier = TextureTier::High8k;
+double g_startupTargetMs = 2000.0;
+
+// Frame counter, used to know which textures were drawn recently
+uint64_t g_frameIndex = 0;
+// Keeps the textures within the VRAM budget set with --vram-budget-mb
+TextureResidency g_textureResidency;
+
+// Linked programs cached on disk, disabled with --no-program-cache
+ProgramCache g_programCache("../shadercache/");
+bool g_useProgramCache = true;
+
+GLuint createGPUprogram(const std::string &defines);
+
 // GPU objects
 GLuint g_program = 0; // A GPU program contains at least a vertex shader and a fragment shader
+// Variants of the program, selected per draw from the material and the albedo source of the mesh
+ShaderPermutations g_shaders(createGPUprogram);
+// Rebuilds the permutations in the background when the GLSL files change, enabled with --watch-shaders
+bool g_watchShaders = false;
+ShaderReloader g_shaderReloader;
+
+// Albedo maps of the bodies packed in one texture array, enabled with --texture-array
+bool g_useTextureArray = false;
+GLuint g_albedoArray = 0;
+
+// The sky map is resampled into a cubemap of --sky-face-size texels (0: same density as the map
+// at the equator), unless --sky-equirect keeps sampling it through the sphere UVs
+bool g_useSkyCubemap = true;
+int g_skyFaceSize = 0;
+
+// Tiled virtual textures (media/<asset>.vt made with vtTiler), enabled with --virtual-textures
+bool g_useVirtualTextures = false;
+VirtualTextureSystem g_virtualTextures;
+
+// Local point lights (satellites orbiting the Earth, --lights N), shaded with clustered forward lighting
+int g_numLights = 0;
+std::vector<PointLight> g_lights;         // positions relative to the camera, updated before each frame
+std::vector<glm::dvec3> g_lightPositions; // world space
+std::vector<glm::vec4> g_lightOrbits; // orbit radius, angular speed, phase, inclination of each light
+ClusteredLights g_clusteredLights;
+
+// Scene rendered offscreen at a scale adapted to its GPU time, enabled with --dynamic-resolution
+bool g_useDynamicResolution = false;
+DynamicResolution g_dynamicResolution;
+
+// Camera uniform block, written from the input read right before the draws are submitted, or
+// with --persistent-camera after (see cameraBuffer.h). The transforms of a frame are relative
+// to the camera position at its start, g_frameOrigin.
+CameraBuffer g_cameraBuffer;
+bool g_persistentCamera = false;
+glm::dvec3 g_frameOrigin;
+
+// Bodies outside the view are not drawn
+FrustumCulling g_frustumCulling;
+
+// Bodies hidden in the previous frame are skipped by the GPU, disabled with --no-occlusion-culling
+bool g_useOcclusionCulling = true;
+OcclusionCulling g_occlusionCulling;
+
+// Reverse-Z depth (float depth buffer, far plane at infinity), disabled with --no-reverse-z.
+// The scene is then always rendered offscreen, in g_dynamicResolution.
+bool g_reverseZ = true;
+
+// Precomputed scattering of the Earth atmosphere, disabled with --no-atmosphere
+bool g_useAtmosphere = true;
+Atmosphere g_atmosphere;
+const static float kAtmosphereExaggeration = 4.f; // a real one would be thinner than a pixel
+const static char *kAtmosphereCache = "../media/atmosphere.lut";
 
 // OpenGL identifiers
 GLuint g_vao = 0;
@@ -57,10 +189,16 @@ public:
     inline void setNear(const float n) { m_near = n; }
     inline float getFar() const { return m_far; }
     inline void setFar(const float n) { m_far = n; }
-    inline void setPosition(const glm::vec3 &p) { m_pos = p; }
-    inline glm::vec3 getPosition() { return m_pos; }
+    // Reversed depth with an infinite far plane, in [0, 1] with glClipControl or else in [-1, 1]
+    inline void setReverseZ(const bool reverse, const bool zeroToOneDepth) {
+        m_reverseZ = reverse;
+        m_zeroToOneDepth = zeroToOneDepth;
+    }
+    inline bool hasZeroToOneDepth() const { return m_zeroToOneDepth; }
+    inline void setPosition(const glm::dvec3 &p) { m_pos = p; }
+    inline glm::dvec3 getPosition() { return m_pos; }
     inline glm::vec3 getForward() { 
-        forward = glm::normalize(glm::vec3(0, 0, 0) - this->getPosition());
+        forward = glm::normalize(glm::vec3(glm::dvec3(0, 0, 0) - this->getPosition()));
         return forward; 
     }
     inline glm::vec3 getRight() { 
@@ -72,36 +210,63 @@ public:
         return up; 
     }
 
+    // Rotation only: the camera is the origin of the positions sent to the GPU (floating
+    // origin), so that they stay small and precise in float wherever the camera is
     inline glm::mat4 computeViewMatrix() const
     {
-        return glm::lookAt(m_pos, glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+        return glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(glm::dvec3(0, 0, 0) - m_pos), glm::vec3(0, 1, 0));
+    }
+    // World space, in double precision, to camera-relative float
+    inline glm::vec3 toCameraRelative(const glm::dvec3 &p) const { return glm::vec3(p - m_pos); }
+    inline glm::mat4 toCameraRelative(const glm::dmat4 &m) const {
+        glm::dmat4 relative = m;
+        relative[3] -= glm::dvec4(m_pos, 0.0);
+        return glm::mat4(relative);
     }
 
     // Returns the projection matrix stemming from the camera intrinsic parameter.
     inline glm::mat4 computeProjectionMatrix() const
     {
-        return glm::perspective(glm::radians(m_fov), m_aspectRatio, m_near, m_far);
+        if (!m_reverseZ)
+            return glm::perspective(glm::radians(m_fov), m_aspectRatio, m_near, m_far);
+        // window depth near / -z: 1 at the near plane, 0 at infinity, so that the precision of
+        // the float depth grows with the distance as the perspective loses it
+        const float f = 1.f / std::tan(glm::radians(m_fov) / 2.f);
+        glm::mat4 p(0.f);
+        p[0][0] = f / m_aspectRatio;
+        p[1][1] = f;
+        p[2][2] = m_zeroToOneDepth ? 0.f : 1.f;
+        p[2][3] = -1.f;
+        p[3][2] = m_zeroToOneDepth ? m_near : 2.f * m_near;
+        return p;
     }
 
 private:
-    glm::vec3 m_pos = glm::vec3(0, 0, 0);
+    glm::dvec3 m_pos = glm::dvec3(0, 0, 0); // world space
     glm::vec3 forward = glm::vec3(0, 0, 0);
     glm::vec3 right = glm::vec3(0, 0, 0);
     glm::vec3 up = glm::vec3(0, 0, 0);
     float m_fov = 45.f;        // Field of view, in degrees
     float m_aspectRatio = 1.f; // Ratio between the width and the height of the image
     float m_near = 0.1f;       // Distance before which geometry is excluded from the rasterization process
-    float m_far = 10.f;        // Distance after which the geometry is excluded from the rasterization process
+    float m_far = 10.f;        // Distance after which the geometry is excluded from the rasterization process (not with reverse-Z, still the depth range of the light clusters)
+    bool m_reverseZ = false;
+    bool m_zeroToOneDepth = false;
 };
 Camera g_camera;
 
+class Mesh;
+// Spheres that may cast an eclipse shadow on a body, see its definition
+const int kMaxOccluders = 4; // as in fragmentShader.glsl
+int collectOccluders(Mesh *receiver, glm::vec4 *occluders);
+
 class Mesh {
 public:
     inline glm::vec3 testNoraml() {
         glm::vec3 tn = glm::vec3(m_vertexNormals[0], m_vertexNormals[1], m_vertexNormals[2]);
         std::cout << "original normal: (" << tn.x << ", " << tn.y << ", " << tn.z << ")" << std::endl;
         const glm::mat4 viewMatrix = g_camera.computeViewMatrix();
-        const glm::mat4 modelMatrix = this->getModelMatrix();
+        const glm::mat4 modelMatrix = glm::mat4(this->getModelMatrix());
         glm::mat4 normalMat = glm::transpose(glm::inverse(glm::mat4(modelMatrix)));
         tn = glm::vec3(normalMat * glm::vec4(tn, 1.0f));
         return tn;
@@ -127,8 +292,8 @@ public:
         color = c; 
         std::cout << "reset color to (" << c.x << ", " << c.y << ", " << c.z << ")" << std::endl;
     };
-    inline glm::vec3 getLightPos() { return lightPos; };
-    inline void setLightPos(const glm::vec3 &lp) { 
+    inline glm::dvec3 getLightPos() { return lightPos; };
+    inline void setLightPos(const glm::dvec3 &lp) { 
         lightPos = lp; 
         std::cout << "reset light position to (" << lp.x << ", " << lp.y << ", " << lp.z << ")" << std::endl;
     };
@@ -137,31 +302,62 @@ public:
         isLight = l; 
         std::cout << "reset isLight to " << l << std::endl;
     };
-    inline glm::vec3 getTranslation() { 
+    // World space transforms are kept in double precision, see Camera::toCameraRelative
+    inline glm::dvec3 getTranslation() { 
         //glm::mat4 modelMatrix = this->getModelMatrix();
         //return glm::vec3(modelMatrix[3][0], modelMatrix[3][1], modelMatrix[3][2]); 
         return translation;
     }  
-    inline void setTranslation(const glm::vec3 &t, const std::shared_ptr<Mesh> &parent = nullptr) {
+    inline void setTranslation(const glm::dvec3 &t, const std::shared_ptr<Mesh> &parent = nullptr) {
         if (parent != nullptr) { 
             translation = parent->getTranslation() + t; }
         else { translation = t; }
-        glm::mat4 modelMatrix = glm::mat4(1.0f);
+        glm::dmat4 modelMatrix = glm::dmat4(1.0);
         modelMatrix = glm::translate(modelMatrix, translation);
         this->setModelMatrix(modelMatrix);
     } 
-    inline glm::mat4 getModelMatrix() { return modelMat; }
-    inline void setModelMatrix(const glm::mat4 &m) { 
+    inline glm::dmat4 getModelMatrix() { return modelMat; }
+    inline void setModelMatrix(const glm::dmat4 &m) { 
         modelMat = m; 
-        glm::vec3 worldPosition = glm::vec3(modelMat[3][0], modelMat[3][1], modelMat[3][2]);
     }
     inline GLuint getTexture() { return textureID; }
-    inline void setTexture(const GLuint texID) { 
+    inline void setTexture(const GLuint texID, const GLenum target = GL_TEXTURE_2D) { 
         textureID = texID;
+        textureTarget = target;
+        isTexture = 1;
+    }
+    // Samples layer l of the albedo texture array instead of its own texture, drawn with the array program
+    inline int getTextureLayer() { return textureLayer; }
+    inline void setTextureLayer(const int l) {
+        textureLayer = l;
         isTexture = 1;
     }
+    // Samples virtual texture v of g_virtualTextures instead of its own texture
+    inline int getVirtualTexture() { return virtualTexture; }
+    inline void setVirtualTexture(const int v) {
+        virtualTexture = v;
+        isTexture = 1;
+    }
+    // Shader permutation drawing the mesh, in the main pass or in the virtual texture feedback pass
+    inline uint32_t getShaderFeatures(const bool feedback = false) {
+        if (atmosphere == 2)
+            return kShaderAtmosphereShell;
+        uint32_t features = isLight ? kShaderEmissive : (isSky ? kShaderSky : kShaderLit);
+        if (virtualTexture >= 0) features |= kShaderVirtualTexture;
+        else if (textureLayer >= 0) features |= kShaderAlbedoArray;
+        else if (textureTarget == GL_TEXTURE_CUBE_MAP) features |= kShaderSkyCubemap;
+        if (feedback) features |= kShaderVtFeedback;
+        else if (!isLight && !isSky) {
+            if (!g_lights.empty()) features |= kShaderClusteredLights;
+            if (atmosphere == 1) features |= kShaderAtmosphere;
+        }
+        return features;
+    }
     inline int IsSky() { return isSky; }
     inline void setSky(const int s) { isSky = s; }
+    // 1: the body is seen through g_atmosphere, 2: the mesh is the shell of g_atmosphere
+    inline int getAtmosphere() { return atmosphere; }
+    inline void setAtmosphere(const int a) { atmosphere = a; }
     // load gpu geometry for the mesh, with this step we initialize the final mesh
     void init() {
         // vao of the mesh
@@ -199,23 +395,20 @@ public:
 
         glBindVertexArray(0); // deactivate the VAO for now, will be activated again when rendering
     }; // should properly set up the geometry buffer
-    // render the mesh
-    void render() {
-        const glm::mat4 viewMatrix = g_camera.computeViewMatrix();
-        const glm::mat4 projMatrix = g_camera.computeProjectionMatrix();
-        const glm::vec3 camPosition = g_camera.getPosition();
+    // render the mesh, or write the virtual texture pages it needs in the feedback pass
+    void render(const bool feedback = false) {
+        // everything the shaders see is relative to the camera, the camera itself is in g_cameraBuffer
         const glm::vec3 surfaceColor = this->getColor();
-        const glm::vec3 lightPosition = this->getLightPos();
-        const int isLight = this->IsLight();
-        const int isSky = this->IsSky();
-        const glm::mat4 modelMatrix = this->getModelMatrix();
+        const glm::vec3 lightPosition = g_camera.toCameraRelative(this->getLightPos());
+        const glm::mat4 modelMatrix = g_camera.toCameraRelative(this->getModelMatrix());
         const glm::vec3 worldPosition = glm::vec3(modelMatrix[3][0], modelMatrix[3][1], modelMatrix[3][2]);
         const GLuint textureID = this->getTexture();
+        const uint32_t features = this->getShaderFeatures(feedback);
+        const GLuint program = g_shaders.get(features);
 
         if (1 == 0) {
             std::cout << "worldPosition: (" << worldPosition.x << ", " << worldPosition.y << ", " << worldPosition.z << ")" << std::endl;
             std::cout << "lightPosition: (" << lightPosition.x << ", " << lightPosition.y << ", " << lightPosition.z << ")" << std::endl;
-            std::cout << "camPosition: (" << camPosition.x << ", " << camPosition.y << ", " << camPosition.z << ")" << std::endl;
             glm::mat3 m = glm::mat3(modelMatrix);
             std::cout << "(" << m[0][0] <<", " << m[0][1] << ", " << m[0][2]  << ", " 
                               << m[1][0] <<", " << m[1][1] << ", " << m[1][2] << ", " 
@@ -223,22 +416,38 @@ public:
             glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
         }
 
-        glUniformMatrix4fv(glGetUniformLocation(g_program, "modelMat"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(g_program, "viewMat"), 1, GL_FALSE, glm::value_ptr(viewMatrix)); 
-        glUniformMatrix4fv(glGetUniformLocation(g_program, "projMat"), 1, GL_FALSE, glm::value_ptr(projMatrix));
-
-        glUniform3f(glGetUniformLocation(g_program, "camPos"), camPosition[0], camPosition[1], camPosition[2]);
-        glUniform3f(glGetUniformLocation(g_program, "surfaceColor"), surfaceColor[0], surfaceColor[1], surfaceColor[2]);
-        glUniform3f(glGetUniformLocation(g_program, "lightPos"), lightPosition[0], lightPosition[1], lightPosition[2]);
-        glUniform3f(glGetUniformLocation(g_program, "worldPos"), worldPosition[0], worldPosition[1], worldPosition[2]);
-
-        glUniform1i(glGetUniformLocation(g_program, "isLight"), isLight);
-        glUniform1i(glGetUniformLocation(g_program, "isSky"), isSky);
+        glUseProgram(program);
+        glUniformMatrix4fv(glGetUniformLocation(program, "modelMat"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+
+        glUniform3f(glGetUniformLocation(program, "surfaceColor"), surfaceColor[0], surfaceColor[1], surfaceColor[2]);
+        glUniform3f(glGetUniformLocation(program, "lightPos"), lightPosition[0], lightPosition[1], lightPosition[2]);
+        glUniform3f(glGetUniformLocation(program, "worldPos"), worldPosition[0], worldPosition[1], worldPosition[2]);
+        if (features & kShaderLit) {
+            glm::vec4 occluders[kMaxOccluders];
+            const int numOccluders = collectOccluders(this, occluders);
+            glUniform4fv(glGetUniformLocation(program, "occluders"), numOccluders, glm::value_ptr(occluders[0]));
+            glUniform1i(glGetUniformLocation(program, "numOccluders"), numOccluders);
+            glUniform1f(glGetUniformLocation(program, "sunRadius"), kSizeSun);
+        }
 
-        if (isTexture == 1) {
+        if (features & kShaderClusteredLights)
+            g_clusteredLights.bind(program, 3);
+        if (features & (kShaderAtmosphere | kShaderAtmosphereShell))
+            g_atmosphere.bind(program, 6, kSizeEarth);
+        if (virtualTexture >= 0) {
+            const float lodBias = feedback ? g_virtualTextures.getLodBias() : 0.f;
+            g_virtualTextures.get(virtualTexture)->bind(program, 1, 2, virtualTexture, lodBias);
+        }
+        else if (textureLayer >= 0) {
+            // the texture array is bound once for all the bodies, only the layer changes
+            glUniform1i(glGetUniformLocation(program, "material.albedoTex"), 0);
+            glUniform1i(glGetUniformLocation(program, "material.albedoLayer"), textureLayer);
+        }
+        else if (isTexture == 1) {
+            g_textureResidency.touch(textureID, g_frameIndex);
             glActiveTexture(GL_TEXTURE0); // activate texture unit 0
-            glBindTexture(GL_TEXTURE_2D, textureID);
-            glUniform1i(glGetUniformLocation(g_program, "material.albedoTex"), 0);
+            glBindTexture(textureTarget, textureID);
+            glUniform1i(glGetUniformLocation(program, "material.albedoTex"), 0);
         }
         
         glBindVertexArray(m_vao);
@@ -305,49 +514,310 @@ private:
     GLuint m_texVbo = 0;
     GLuint m_ibo = 0;
     GLuint textureID;
+    GLenum textureTarget = GL_TEXTURE_2D;
+    int textureLayer = -1;
+    int virtualTexture = -1;
     float radius = 1.f;
     int isLight = 0;
     int isSky = 0;
     int isTexture = 0;
-    glm::vec3 translation = glm::vec3(0.f, 0.f, 0.f);
+    int atmosphere = 0;
+    glm::dvec3 translation = glm::dvec3(0.0, 0.0, 0.0);
     glm::vec3 color = glm::vec3(0.f, 0.f, 0.f);
-    glm::vec3 lightPos = glm::vec3(0.f, 0.f, 0.f);
-    glm::mat4 modelMat = glm::mat4(1.0f);
+    glm::dvec3 lightPos = glm::dvec3(0.0, 0.0, 0.0);
+    glm::dmat4 modelMat = glm::dmat4(1.0);
 };
 std::vector<std::shared_ptr<Mesh>> meshes;
+std::shared_ptr<Mesh> g_atmosphereShell; // drawn over the bodies, follows the Earth
+
+// Gathers the bodies that can eclipse the sun for some point of the receiver: the spheres lying
+// between the sun and the receiver, and close enough to the sun-receiver axis for the receiver
+// to enter their penumbra cone. Returns their count, at most kMaxOccluders, with their centers
+// relative to the camera.
+int collectOccluders(Mesh *receiver, glm::vec4 *occluders)
+{
+    const glm::dvec3 p = glm::dvec3(receiver->getModelMatrix()[3]);
+    const double receiverRadius = receiver->getRadius();
+    const glm::dvec3 sun = receiver->getLightPos();
+    const double axisLength = glm::length(p - sun);
+    if (axisLength <= 0.0)
+        return 0;
+    const glm::dvec3 axis = (p - sun) / axisLength;
+    int n = 0;
+    for (const auto &mesh : meshes) {
+        if (mesh.get() == receiver || mesh->IsLight() || mesh->IsSky() || n == kMaxOccluders)
+            continue;
+        const glm::dvec3 c = glm::dvec3(mesh->getModelMatrix()[3]);
+        const double r = mesh->getRadius();
+        const double t = glm::dot(c - sun, axis); // distance along the axis from the sun
+        if (t <= kSizeSun || t >= axisLength + receiverRadius)
+            continue;
+        // the penumbra widens behind the occluder with the angular size of the sun seen from it
+        const double penumbra = r + (axisLength + receiverRadius - t) * (kSizeSun + r) / t;
+        if (glm::length(c - sun - t * axis) < penumbra + receiverRadius)
+            occluders[n++] = glm::vec4(g_camera.toCameraRelative(c), static_cast<float>(r));
+    }
+    return n;
+}
+
+
+// Decodes an image file into level 0 of an existing texture and builds its mip chain.
+// Returns false, leaving the texture untouched, if the file cannot be decoded.
+bool uploadTextureFromFile(GLuint texID, const std::string &filename, ImageInfo &info)
+{
+    // Reading the encoded file and picking the decoder backend for its format
+    std::vector<unsigned char> storage;
+    AssetView fileData; // points into the asset pack, or into storage
+    const ImageDecoder *decoder = nullptr;
+    if (loadAsset(filename, fileData, storage))
+        decoder = findImageDecoder(fileData.data, fileData.size, info);
+    if (decoder == nullptr)
+        return false;
+
+    // The image is decoded straight into a mapped pixel unpack buffer, no intermediate CPU copy
+    GLuint pbo;
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    bool decoded = false;
+    while (decoder != nullptr && !decoded) {
+        const size_t stride = (info.rowSize() + 3) & ~size_t(3); // rows aligned on 4 bytes, the default GL_UNPACK_ALIGNMENT
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, stride * info.height, nullptr, GL_STREAM_DRAW);
+        unsigned char *dst = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, stride * info.height,
+                                                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        decoded = dst != nullptr && decoder->decode(fileData.data, fileData.size, info, dst, stride);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        if (!decoded) // rejected past the header: the next backend, down to stb
+            decoder = findImageDecoder(fileData.data, fileData.size, info, decoder);
+    }
+
+    if (decoded) {
+        const GLenum formats[] = {GL_RGB, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+        const GLenum format = formats[info.numComponents];
+        // Fill the GPU texture with the data stored in the pixel unpack buffer
+        glBindTexture(GL_TEXTURE_2D, texID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, info.width, info.height, 0, format, GL_UNSIGNED_BYTE, 0);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &pbo); // the driver keeps the storage alive until the upload is done
+    return decoded;
+}
 
+// Decodes an image file again into dst (rows stride bytes apart), on the worker thread of the
+// residency manager. Fails if the file no longer matches the image first uploaded.
+bool decodeTextureFile(const std::string &filename, const ImageInfo &expected, unsigned char *dst, size_t stride)
+{
+    std::vector<unsigned char> storage;
+    AssetView fileData;
+    if (!loadAsset(filename, fileData, storage))
+        return false;
+    ImageInfo info;
+    for (const ImageDecoder *decoder = findImageDecoder(fileData.data, fileData.size, info); decoder != nullptr;
+         decoder = findImageDecoder(fileData.data, fileData.size, info, decoder)) {
+        if (info.width != expected.width || info.height != expected.height || info.numComponents != expected.numComponents)
+            return false;
+        if (decoder->decode(fileData.data, fileData.size, info, dst, stride))
+            return true;
+    }
+    return false;
+}
 
 GLuint loadTextureFromFileToGPU(const std::string &filename)
 {
-    // Loading the image in CPU memory using stb_image
-    int width, height, numComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &numComponents, 0);
     GLuint texID; // OpenGL texture identifier
     glGenTextures(1, &texID); // generate an OpenGL texture container
     glBindTexture(GL_TEXTURE_2D, texID); // activate the texture
     // Setup the texture filtering option and repeat mode; check www.opengl.org for details.
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // mip-mapped, so the residency manager can drop the top levels
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // Fill the GPU texture with the data stored in the CPU image
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    // Free useless CPU memory
-    stbi_image_free(data);
     glBindTexture(GL_TEXTURE_2D, 0); // unbind the texture
+
+    ImageInfo info;
+    if (!uploadTextureFromFile(texID, filename, info)) {
+        // Never leave the texture without storage: a single magenta texel makes the problem visible
+        std::cerr << "ERROR: could not load texture " << filename << std::endl;
+        const unsigned char magenta[4] = {255, 0, 255, 255};
+        glBindTexture(GL_TEXTURE_2D, texID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, magenta);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texID;
+    }
+    g_textureResidency.track(texID, info.width, info.height, info.numComponents, [filename, info](unsigned char *dst, size_t stride) {
+        return decodeTextureFile(filename, info, dst, stride);
+    });
+    return texID;
+}
+
+// Loads the texture of a named asset ("earth", "stars"...) at the selected quality tier,
+// or the closest one available, and reports which file was used.
+GLuint loadTextureAsset(const std::string &name)
+{
+    std::string path;
+    TextureTier found;
+    if (!g_assets.resolve(name, g_textureTier, path, found)) {
+        std::cerr << "ERROR: no texture file for asset " << name << std::endl;
+        return loadTextureFromFileToGPU(g_assets.pathFor(name, g_textureTier)); // placeholder texture
+    }
+    std::cout << "asset " << name << ": " << path << " (tier " << tierName(found);
+    if (found != g_textureTier)
+        std::cout << ", " << tierName(g_textureTier) << " not available";
+    std::cout << ")" << std::endl;
+    return loadTextureFromFileToGPU(path);
+}
+
+// Bilinear resampling of an RGB image
+void resampleImage(const std::vector<unsigned char> &src, int srcWidth, int srcHeight,
+                   std::vector<unsigned char> &dst, int dstWidth, int dstHeight)
+{
+    dst.resize(static_cast<size_t>(dstWidth) * dstHeight * 3);
+    for (int y = 0; y < dstHeight; y++) {
+        const float sy = std::max(0.f, (y + 0.5f) * srcHeight / dstHeight - 0.5f);
+        const int y0 = std::min(static_cast<int>(sy), srcHeight - 1), y1 = std::min(y0 + 1, srcHeight - 1);
+        const float fy = sy - y0;
+        for (int x = 0; x < dstWidth; x++) {
+            const float sx = std::max(0.f, (x + 0.5f) * srcWidth / dstWidth - 0.5f);
+            const int x0 = std::min(static_cast<int>(sx), srcWidth - 1), x1 = std::min(x0 + 1, srcWidth - 1);
+            const float fx = sx - x0;
+            for (int c = 0; c < 3; c++) {
+                const float top = src[(y0 * srcWidth + x0) * 3 + c] * (1 - fx) + src[(y0 * srcWidth + x1) * 3 + c] * fx;
+                const float bottom = src[(y1 * srcWidth + x0) * 3 + c] * (1 - fx) + src[(y1 * srcWidth + x1) * 3 + c] * fx;
+                dst[(static_cast<size_t>(y) * dstWidth + x) * 3 + c] = static_cast<unsigned char>(top * (1 - fy) + bottom * fy + 0.5f);
+            }
+        }
+    }
+}
+
+// Packs the albedo maps of several assets in the layers of a single GL_TEXTURE_2D_ARRAY,
+// layer i holding names[i]. Maps of different sizes are resampled to the largest one.
+GLuint loadTextureArrayAssets(const std::vector<std::string> &names)
+{
+    std::vector<std::vector<unsigned char>> layers(names.size());
+    std::vector<ImageInfo> infos(names.size());
+    int width = 1, height = 1;
+    for (size_t i = 0; i < names.size(); i++) {
+        std::string path;
+        TextureTier found;
+        if (!g_assets.resolve(names[i], g_textureTier, path, found) || !decodeImageFile(path, infos[i], layers[i])) {
+            std::cerr << "ERROR: no texture file for asset " << names[i] << std::endl;
+            infos[i].width = infos[i].height = 1;
+            infos[i].numComponents = 3;
+            layers[i] = {255, 0, 255};
+        }
+        else {
+            std::cout << "asset " << names[i] << ": " << path << " (tier " << tierName(found) << ", layer " << i << ")" << std::endl;
+        }
+        // expand to RGB
+        if (infos[i].numComponents != 3) {
+            std::vector<unsigned char> rgb(static_cast<size_t>(infos[i].width) * infos[i].height * 3);
+            for (size_t p = 0; p < rgb.size() / 3; p++)
+                for (int c = 0; c < 3; c++)
+                    rgb[p * 3 + c] = layers[i][p * infos[i].numComponents + (infos[i].numComponents < 3 ? 0 : c)];
+            layers[i].swap(rgb);
+            infos[i].numComponents = 3;
+        }
+        width = std::max(width, infos[i].width);
+        height = std::max(height, infos[i].height);
+    }
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    width = std::min(width, static_cast<int>(maxSize));
+    height = std::min(height, static_cast<int>(maxSize));
+
+    GLuint texID;
+    glGenTextures(1, &texID);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texID);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, width, height, static_cast<GLsizei>(names.size()), 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    std::vector<unsigned char> resampled;
+    for (size_t i = 0; i < names.size(); i++) {
+        const unsigned char *pixels = layers[i].data();
+        if (infos[i].width != width || infos[i].height != height) {
+            resampleImage(layers[i], infos[i].width, infos[i].height, resampled, width, height);
+            pixels = resampled.data();
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>(i), width, height, 1, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
     return texID;
 }
 
+// Streams the map of an asset through a virtual texture when media/<name>.vt exists.
+// Returns false when the mesh should use a regular texture instead.
+bool attachVirtualTexture(const std::shared_ptr<Mesh> &mesh, const std::string &name)
+{
+    if (!g_useVirtualTextures)
+        return false;
+    const std::string filename = "../media/" + name + ".vt";
+    if (!std::ifstream(filename.c_str()).good())
+        return false;
+    std::unique_ptr<VirtualTexture> vt(new VirtualTexture());
+    if (!vt->open(filename))
+        return false;
+    mesh->setVirtualTexture(g_virtualTextures.add(std::move(vt)));
+    return true;
+}
+
+// Samples the sky by direction from a cubemap converted from the equirectangular map of the asset.
+// Returns false when the mesh should use the map directly instead.
+bool attachSkyCubemap(const std::shared_ptr<Mesh> &mesh, const std::string &name)
+{
+    std::string path;
+    TextureTier found;
+    if (!g_useSkyCubemap || !g_assets.resolve(name, g_textureTier, path, found))
+        return false;
+    const GLuint cubemap = loadSkyCubemap(path, g_skyFaceSize);
+    if (cubemap == 0)
+        return false;
+    std::cout << "asset " << name << ": " << path << " (tier " << tierName(found) << ", cubemap)" << std::endl;
+    mesh->setTexture(cubemap, GL_TEXTURE_CUBE_MAP);
+    return true;
+}
+
+// Size of the window, or of the headless framebuffer
+void getWindowSize(int &width, int &height)
+{
+    if (g_headless) {
+        width = g_headlessContext.getWidth();
+        height = g_headlessContext.getHeight();
+    }
+    else {
+        glfwGetWindowSize(g_window, &width, &height);
+    }
+}
+
+void getFramebufferSize(int &width, int &height)
+{
+    if (g_headless)
+        getWindowSize(width, height);
+    else
+        glfwGetFramebufferSize(g_window, &width, &height);
+}
+
 // Executed each time the window is resized. Adjust the aspect ratio and the rendering viewport to the current window.
 void windowSizeCallback(GLFWwindow *window, int width, int height)
 {
+    g_redraw = true;
     g_camera.setAspectRatio(static_cast<float>(width) / static_cast<float>(height));
     glViewport(0, 0, (GLint)width, (GLint)height); // Dimension of the rendering region in the window
+    if (!g_virtualTextures.empty())
+        g_virtualTextures.resize(width, height);
 }
 
 // Executed each time a key is entered.
 void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
+    g_redraw = true; // includes the repeats of a held key, which move the camera
+    g_framePacing.inputEvent();
     if (action == GLFW_PRESS && key == GLFW_KEY_R)
     {
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);            // Draw mesh edges as lines. Uncomment this line to draw only lines.
@@ -358,55 +828,131 @@ void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
     {
         glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);            // Draw mesh faces. Uncomment this line to draw only faces.
     }
+    else if (action == GLFW_PRESS && key == GLFW_KEY_O)
+    {
+        std::cout << "occlusion culling: " << g_occlusionCulling.getCulledDraws() << " of "
+                  << g_occlusionCulling.getTestedDraws() << " conditional draws skipped last frame" << std::endl;
+    }
+    else if (action == GLFW_PRESS && key == GLFW_KEY_L)
+    {
+        g_framePacing.printStats();
+    }
+    else if (action == GLFW_PRESS && key == GLFW_KEY_F12)
+    {
+        if (!g_frameCapture.isActive())
+            g_frameCapture.start("screenshot_%04d.png", 1);
+    }
+    else if (action == GLFW_PRESS && key == GLFW_KEY_P)
+    {
+        g_paused = !g_paused;
+        g_simulation.setPaused(g_paused);
+        std::cout << (g_paused ? "paused" : "resumed") << std::endl;
+    }
     else if (action == GLFW_PRESS && (key == GLFW_KEY_ESCAPE || key == GLFW_KEY_Q))
     {
         glfwSetWindowShouldClose(window, true);               // Closes the application if the escape key is pressed
     }
     else if (action == GLFW_PRESS && key == GLFW_KEY_W) {
-        g_camera.setPosition(g_camera.getPosition() + cameraSpeed * g_camera.getForward());
+        g_camera.setPosition(g_camera.getPosition() + glm::dvec3(cameraSpeed * g_camera.getForward()));
         std::cout << "Key pressed: " << key << std::endl;
     }
     else if (action == GLFW_PRESS && key == GLFW_KEY_S) {
-        g_camera.setPosition(g_camera.getPosition() - cameraSpeed * g_camera.getForward());
+        g_camera.setPosition(g_camera.getPosition() - glm::dvec3(cameraSpeed * g_camera.getForward()));
         std::cout << "Key pressed: " << key << std::endl;
     }
     else if (action == GLFW_PRESS && key == GLFW_KEY_A) {
-        g_camera.setPosition(g_camera.getPosition() - cameraSpeed * g_camera.getRight());
+        g_camera.setPosition(g_camera.getPosition() - glm::dvec3(cameraSpeed * g_camera.getRight()));
         std::cout << "Key pressed: " << key << std::endl;
     }
     else if (action == GLFW_PRESS && key == GLFW_KEY_D) {
-        g_camera.setPosition(g_camera.getPosition() + cameraSpeed * g_camera.getRight());
+        g_camera.setPosition(g_camera.getPosition() + glm::dvec3(cameraSpeed * g_camera.getRight()));
         std::cout << "Key pressed: " << key << std::endl;
     }
     else if (action == GLFW_PRESS && key == GLFW_KEY_Z) {
-        g_camera.setPosition(g_camera.getPosition() + cameraSpeed * g_camera.getUp());
+        g_camera.setPosition(g_camera.getPosition() + glm::dvec3(cameraSpeed * g_camera.getUp()));
         std::cout << "Key pressed: " << key << std::endl;
     }
     else if (action == GLFW_PRESS && key == GLFW_KEY_X) {
-        g_camera.setPosition(g_camera.getPosition() - cameraSpeed * g_camera.getUp());
+        g_camera.setPosition(g_camera.getPosition() - glm::dvec3(cameraSpeed * g_camera.getUp()));
         std::cout << "Key pressed: " << key << std::endl;  
     }     
 }
 
+// A camera key is held: the view changes every frame
+bool anyMoveKeyPressed()
+{
+    const int keys[] = {GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_Z, GLFW_KEY_X};
+    for (const int key : keys) {
+        if (glfwGetKey(g_window, key) == GLFW_PRESS)
+            return true;
+    }
+    return false;
+}
+
 void checkKey() {
+    if (anyMoveKeyPressed())
+        g_framePacing.inputEvent();
     if (glfwGetKey(g_window, GLFW_KEY_W) == GLFW_PRESS) {
-        g_camera.setPosition(g_camera.getPosition() + cameraSpeed * g_camera.getForward());
+        g_camera.setPosition(g_camera.getPosition() + glm::dvec3(cameraSpeed * g_camera.getForward()));
     }
     else if (glfwGetKey(g_window, GLFW_KEY_S) == GLFW_PRESS) {
-        g_camera.setPosition(g_camera.getPosition() - cameraSpeed * g_camera.getForward());
+        g_camera.setPosition(g_camera.getPosition() - glm::dvec3(cameraSpeed * g_camera.getForward()));
     }
     else if (glfwGetKey(g_window, GLFW_KEY_A) == GLFW_PRESS) {
-        g_camera.setPosition(g_camera.getPosition() - cameraSpeed * g_camera.getRight());
+        g_camera.setPosition(g_camera.getPosition() - glm::dvec3(cameraSpeed * g_camera.getRight()));
     }
     else if (glfwGetKey(g_window, GLFW_KEY_D) == GLFW_PRESS) {
-        g_camera.setPosition(g_camera.getPosition() + cameraSpeed * g_camera.getRight());
+        g_camera.setPosition(g_camera.getPosition() + glm::dvec3(cameraSpeed * g_camera.getRight()));
     }
     else if (glfwGetKey(g_window, GLFW_KEY_Z) == GLFW_PRESS) {
-        g_camera.setPosition(g_camera.getPosition() + cameraSpeed * g_camera.getUp());
+        g_camera.setPosition(g_camera.getPosition() + glm::dvec3(cameraSpeed * g_camera.getUp()));
     }
     else if (glfwGetKey(g_window, GLFW_KEY_X) == GLFW_PRESS) {
-        g_camera.setPosition(g_camera.getPosition() - cameraSpeed * g_camera.getUp());
+        g_camera.setPosition(g_camera.getPosition() - glm::dvec3(cameraSpeed * g_camera.getUp()));
+    }
+}
+
+// Camera of the frame, for transforms relative to origin
+CameraBlock cameraBlock(const glm::dvec3 &origin)
+{
+    const glm::vec3 offset = glm::vec3(g_camera.getPosition() - origin);
+    CameraBlock block;
+    block.viewMat = glm::translate(g_camera.computeViewMatrix(), -offset);
+    block.projMat = g_camera.computeProjectionMatrix();
+    block.camPos = glm::vec4(offset, 1.f);
+    return block;
+}
+
+// Reads the input once more and writes the camera of the frame from it (late latching). With
+// the persistent buffer this follows the draws: the frame keeps its origin and the view matrix
+// absorbs the move. Otherwise it precedes them, and they are relative to the new position.
+void latchCamera()
+{
+    if (!g_headless) {
+        glfwPollEvents();
+        checkKey();
     }
+    if (!g_cameraBuffer.isPersistent())
+        g_frameOrigin = g_camera.getPosition();
+    g_cameraBuffer.write(cameraBlock(g_frameOrigin));
+}
+
+// Executed when the window content was damaged (e.g. uncovered) and must be drawn again.
+void windowRefreshCallback(GLFWwindow *window)
+{
+    g_redraw = true;
+}
+
+// Executed when the window is minimized or restored.
+void windowIconifyCallback(GLFWwindow *window, int iconified)
+{
+    g_redraw = true;
+}
+
+// Executed when the window gains or loses the input focus.
+void windowFocusCallback(GLFWwindow *window, int focused)
+{
+    g_frameLimiter.setMaxFps(focused ? g_maxFps : g_backgroundFps);
 }
 
 // Executed each time when an error occurs.
@@ -433,6 +979,8 @@ void initGLFW()
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
+    if (g_reverseZ)
+        glfwWindowHint(GLFW_DEPTH_BITS, 0); // the scene has its own float depth buffer
 
     // Create the window
     g_window = glfwCreateWindow(
@@ -450,48 +998,102 @@ void initGLFW()
     glfwMakeContextCurrent(g_window);
     glfwSetWindowSizeCallback(g_window, windowSizeCallback);
     glfwSetKeyCallback(g_window, keyCallback);
+    glfwSetWindowRefreshCallback(g_window, windowRefreshCallback);
+    glfwSetWindowIconifyCallback(g_window, windowIconifyCallback);
+    glfwSetWindowFocusCallback(g_window, windowFocusCallback);
 }
 
 // Initialize OpenGL
 void initOpenGL()
 {
-    // Load extensions for modern OpenGL
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    // Load extensions for modern OpenGL (the headless context loaded glad already)
+    if (!g_headless && !gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
     {
         std::cerr << "ERROR: Failed to initialize OpenGL context" << std::endl;
         glfwTerminate();
         std::exit(EXIT_FAILURE);
     }
+    loadGLExtensions(g_headless ? HeadlessContext::getProcAddress : (GLADloadproc)glfwGetProcAddress);
+    if (!g_cameraBuffer.init(g_persistentCamera) && g_persistentCamera)
+        std::cerr << "WARNING: persistent buffers are not supported, the camera is written before the draws" << std::endl;
+
+    // swap interval, frame rate cap and frame statistics
+    const GLFWvidmode *videoMode = g_headless ? nullptr : glfwGetVideoMode(glfwGetPrimaryMonitor());
+    const double refreshRate = videoMode != nullptr ? videoMode->refreshRate : 60.0;
+    g_presentMode = g_framePacing.init(g_window, g_presentMode, g_frameDeadline, refreshRate);
+    if (g_presentMode == PresentMode::Capped && g_maxFps <= 0.0)
+        g_maxFps = refreshRate;
+    g_frameLimiter.setMaxFps(g_maxFps);
+    g_programCache.init();
+    g_programCache.setEnabled(g_useProgramCache);
 
     glCullFace(GL_BACK);                  // Specifies the faces to cull (here the ones pointing away from the camera)
     glEnable(GL_CULL_FACE);               // Enables face culling (based on the orientation defined by the CW/CCW enumeration).
-    glDepthFunc(GL_LESS);                 // Specify the depth test for the z-buffer, if the stored value is greater than the one from the fragment then discard.
+    if (g_reverseZ) {
+        // glClipControl keeps the depth in [0, 1], without it [-1, 1] is remapped to [0, 1] and
+        // the low bits near 0 (the far distances) are rounded away
+        const bool zeroToOne = glClipControl != nullptr;
+        if (zeroToOne)
+            glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        g_camera.setReverseZ(true, zeroToOne);
+        g_dynamicResolution.setDepthFormat(GL_DEPTH_COMPONENT32F);
+        if (!g_useDynamicResolution)
+            g_dynamicResolution.setScaleRange(1.f, 1.f);
+        glClearDepth(0.0);
+        glDepthFunc(GL_GREATER);          // nearer is greater
+    }
+    else {
+        glDepthFunc(GL_LESS);             // Specify the depth test for the z-buffer, if the stored value is greater than the one from the fragment then discard.
+    }
     glEnable(GL_DEPTH_TEST);              // Enable the z-buffer test in the rasterization
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // specify the background color, used any time the framebuffer is cleared
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // filter across the edges of the sky cubemap faces
 }
 
-// Loads the content of an ASCII file in a standard C++ string
-std::string file2String(const std::string &filename)
+// Loads the content of an ASCII file in a standard C++ string, from the asset pack when fromPack
+// and the pack has it. Returns false if the file cannot be read; the shader reloader thread
+// gets here too, so the caller decides what a missing file means.
+bool file2String(const std::string &filename, std::string &content, const bool fromPack = true)
 {
+    AssetView view;
+    std::vector<unsigned char> storage;
+    if (fromPack && loadAsset(filename, view, storage)) {
+        content = view.str();
+        return true;
+    }
     std::ifstream t(filename.c_str());   // open the ASCII file for reading, .c_str() transforms a std::string into a C-style char*
     if (!t.is_open()) {
         std::cerr << "ERROR: file " << filename << " not found" << std::endl;
-        std::exit(EXIT_FAILURE);
+        return false;
     }
     std::stringstream buffer;            // temporary buffer to read the file 
     buffer << t.rdbuf();                 // stream the file into the buffer
     if (t.fail()) {
         std::cerr << "ERROR: Could not read file " << filename << std::endl;
-        std::exit(EXIT_FAILURE);
+        return false;
     }
-    return buffer.str();                 // return the content of the buffer, which is a std::string type
+    content = buffer.str();              // the content of the buffer, which is a std::string type
+    return true;
 }
 
-// Loads and compile a shader, before attaching it to a program
-void loadShader(GLuint program, GLenum type, const std::string &shaderFilename)
+// Loads the source of a shader. The defines (e.g. "#define ALBEDO_ARRAY\n") are inserted right
+// after the #version line. Returns false if the file cannot be read.
+bool loadShaderSource(const std::string &shaderFilename, std::string &shaderSourceString, const std::string &defines = "")
+{
+    // while watching the shaders, the sources are read from the files being edited, never from the pack
+    if (!file2String(shaderFilename, shaderSourceString, !g_watchShaders)) // Loads the shader source from a file to a C++ string
+        return false;
+    if (!defines.empty()) {
+        const size_t versionEnd = shaderSourceString.find('\n') + 1;
+        shaderSourceString.insert(versionEnd, defines);
+    }
+    return true;
+}
+
+// Compiles a shader from its source, before attaching it to a program.
+void loadShader(GLuint program, GLenum type, const std::string &shaderFilename, const std::string &shaderSourceString)
 {
     GLuint shader = glCreateShader(type);                                    // Create the shader, e.g., a vertex shader to be applied to every single vertex of a mesh
-    std::string shaderSourceString = file2String(shaderFilename);            // Loads the shader source from a file to a C++ string
     const GLchar *shaderSource = (const GLchar *)shaderSourceString.c_str(); // Interface the C++ string through a C pointer
     glShaderSource(shader, 1, &shaderSource, NULL);                          // load the vertex shader code
     glCompileShader(shader);
@@ -507,12 +1109,46 @@ void loadShader(GLuint program, GLenum type, const std::string &shaderFilename)
     glDeleteShader(shader);
 }
 
+// Builds the program of a shader permutation, from the program cache when the same sources
+// were already linked by this driver. Returns 0 if a source cannot be read or it does not link.
+GLuint createGPUprogram(const std::string &defines)
+{
+    std::string vertexSource, fragmentSource;
+    if (!loadShaderSource("../vertexShader.glsl", vertexSource, defines) ||
+        !loadShaderSource("../fragmentShader.glsl", fragmentSource, defines))
+        return 0; // e.g. a shader being saved by rename, the reloader keeps the old program
+    GLuint program = glCreateProgram(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
+    const uint64_t key = g_programCache.key({vertexSource, fragmentSource});
+    if (g_programCache.load(key, program)) {
+        CameraBuffer::bindProgram(program);
+        return program;
+    }
+    loadShader(program, GL_VERTEX_SHADER, "../vertexShader.glsl", vertexSource);
+    loadShader(program, GL_FRAGMENT_SHADER, "../fragmentShader.glsl", fragmentSource);
+    g_programCache.prepare(program);
+    glLinkProgram(program); // The main GPU program is ready to be handle streams of polygons
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        GLchar infoLog[512];
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cout << "ERROR in linking the program with\n" << defines << "\t" << infoLog << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    g_programCache.store(key, program);
+    CameraBuffer::bindProgram(program);
+    return program;
+}
+
 void initGPUprogram()
 {
-    g_program = glCreateProgram(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
-    loadShader(g_program, GL_VERTEX_SHADER, "../vertexShader.glsl");
-    loadShader(g_program, GL_FRAGMENT_SHADER, "../fragmentShader.glsl");
-    glLinkProgram(g_program); // The main GPU program is ready to be handle streams of polygons
+    g_program = g_shaders.get(kShaderLit);
+    if (g_program == 0) {
+        std::cerr << "ERROR: Failed to build the GPU program" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
 
     glUseProgram(g_program);
     // TODO: set shader variables, textures, etc.
@@ -590,10 +1226,10 @@ void initGPUgeometry()
 void initCamera()
 {
     int width, height;
-    glfwGetWindowSize(g_window, &width, &height);
+    getWindowSize(width, height);
     g_camera.setAspectRatio(static_cast<float>(width) / static_cast<float>(height));
 
-    g_camera.setPosition(glm::vec3(0.0, 0.0, 30.0));
+    g_camera.setPosition(glm::dvec3(0.0, 0.0, 30.0));
     g_camera.setNear(0.1);
     g_camera.setFar(80.1);
     g_camera.getForward();
@@ -601,52 +1237,150 @@ void initCamera()
     g_camera.getUp();
 }
 
+// Scatters n small colored lights on random orbits around the Earth
+void initLights(const int n)
+{
+    std::srand(42);
+    const auto random = [](float a, float b) { return a + (b - a) * static_cast<float>(std::rand()) / RAND_MAX; };
+    for (int i = 0; i < n; i++) {
+        PointLight light;
+        light.position = glm::vec3(0.f);
+        light.radius = random(0.2f, 0.6f);
+        light.color = glm::vec3(random(0.2f, 1.f), random(0.2f, 1.f), random(0.2f, 1.f));
+        g_lights.push_back(light);
+        g_lightPositions.push_back(glm::dvec3(0.0));
+        g_lightOrbits.push_back(glm::vec4(random(0.6f, 1.2f), random(0.5f, 2.f), random(0.f, 6.28f), random(-1.5f, 1.5f)));
+    }
+}
+
+// Creates the headless context, whose framebuffer stands for the window
+void initHeadless()
+{
+    if (!g_headlessContext.init(g_headlessWidth, g_headlessHeight))
+        std::exit(EXIT_FAILURE);
+    g_dynamicResolution.setOutputFramebuffer(g_headlessContext.getFramebuffer());
+    if (!g_useDynamicResolution)
+        g_dynamicResolution.setScaleRange(1.f, 1.f);
+    if (g_watchShaders) {
+        std::cerr << "WARNING: --watch-shaders needs a window, ignored" << std::endl;
+        g_watchShaders = false;
+    }
+}
+
 void init()
 {
-    initGLFW();
+    if (g_headless)
+        initHeadless();
+    else
+        initGLFW();
     initOpenGL(); 
     
+    // texture quality tier, from the memory budget and the startup time target
+    if (!g_forceTextureTier)
+        g_textureTier = g_assets.selectTier({"earth", "moon", "sun", "stars"}, g_textureResidency.getBudget(), g_startupTargetMs);
+
     // mesh init
     std::shared_ptr<Mesh> Earth = Mesh::genSphere(32);
     initGPUprogram();
     Earth->init();
     Earth->setRadius(kSizeEarth);
-    Earth->setTranslation(glm::vec3(10.0f, 0.0f, 0.0f));
+    Earth->setTranslation(glm::dvec3(10.0, 0.0, 0.0));
     //Earth->setColor(glm::vec3(0.0f, 1.0f, 0.0f));
-    Earth->setTexture(loadTextureFromFileToGPU("../media/8k_earth.jpg"));
+    if (!attachVirtualTexture(Earth, "earth") && !g_useTextureArray)
+        Earth->setTexture(loadTextureAsset("earth"));
     meshes.push_back(Earth);
+
+    if (g_useAtmosphere) {
+        AtmosphereParameters atmosphere;
+        atmosphere.exaggerate(kAtmosphereExaggeration);
+        g_atmosphere.init(atmosphere, kAtmosphereCache);
+        Earth->setAtmosphere(1);
+        g_atmosphereShell = Mesh::genSphere(64);
+        g_atmosphereShell->init();
+        g_atmosphereShell->setRadius(g_atmosphere.shellRadius(kSizeEarth));
+        g_atmosphereShell->setAtmosphere(2);
+    }
     
     std::shared_ptr<Mesh> Moon = Mesh::genSphere(32);
     Moon->init();
     Moon->setRadius(kSizeMoon);
-    Moon->setTranslation(glm::vec3(2.0f, 0.0f, 0.0f), Earth);
+    Moon->setTranslation(glm::dvec3(2.0, 0.0, 0.0), Earth);
     //Moon->setColor(glm::vec3(0.0f, 0.0f, 1.0f));
-    Moon->setTexture(loadTextureFromFileToGPU("../media/8k_moon.jpg"));
+    if (!g_useTextureArray)
+        Moon->setTexture(loadTextureAsset("moon"));
     meshes.push_back(Moon);
 
     std::shared_ptr<Mesh> Sun = Mesh::genSphere(32);
     Sun->init();
     Sun->setRadius(kSizeSun);
-    Sun->setTranslation(glm::vec3(0.0f, 0.0f, 0.0f));
+    Sun->setTranslation(glm::dvec3(0.0, 0.0, 0.0));
     //Sun->setColor(glm::vec3(1.0f, 1.0f, 0.0f));
-    Sun->setTexture(loadTextureFromFileToGPU("../media/sun.jpg"));
+    if (!g_useTextureArray)
+        Sun->setTexture(loadTextureAsset("sun"));
     Sun->setIsLight(1);
     meshes.push_back(Sun);
 
+    if (g_useTextureArray) {
+        // the bodies share one texture array, the sky keeps its own (much larger) texture
+        g_albedoArray = loadTextureArrayAssets({"earth", "moon", "sun"});
+        for (int i = 0; i < 3; i++)
+            meshes[i]->setTextureLayer(i);
+    }
+
     std::shared_ptr<Mesh> SkySphere = Mesh::genSphere(64);
     SkySphere->init();
     SkySphere->setRadius(50);
-    SkySphere->setTranslation(glm::vec3(0.0f, 0.0f, 0.0f));
-    SkySphere->setTexture(loadTextureFromFileToGPU("../media/8k_stars.jpg"));
+    SkySphere->setTranslation(glm::dvec3(0.0, 0.0, 0.0));
+    if (!attachVirtualTexture(SkySphere, "stars") && !attachSkyCubemap(SkySphere, "stars"))
+        SkySphere->setTexture(loadTextureAsset("stars"));
     SkySphere->setSky(1);
     meshes.push_back(SkySphere);
 
     initCamera();
+    initLights(g_numLights);
+
+    // build the permutations used by the scene now rather than on their first draw
+    for (const auto &mesh : meshes) {
+        g_shaders.get(mesh->getShaderFeatures());
+        if (mesh->getVirtualTexture() >= 0)
+            g_shaders.get(mesh->getShaderFeatures(true));
+    }
+    if (g_atmosphereShell)
+        g_shaders.get(g_atmosphereShell->getShaderFeatures());
+    if (g_useOcclusionCulling)
+        g_shaders.get(kShaderEmissive); // draws the bounding boxes
+    std::cout << g_shaders.size() << " shader permutations" << std::endl;
+    if (g_watchShaders)
+        g_shaderReloader.start(g_window, {"../vertexShader.glsl", "../fragmentShader.glsl"}, createGPUprogram);
+
+    if (!g_virtualTextures.empty()) {
+        int width, height;
+        getWindowSize(width, height);
+        g_virtualTextures.resize(width, height);
+    }
+
+    g_simulation.start(1.0 / g_simulationRate, simulate);
+    if (!g_capturePattern.empty())
+        g_frameCapture.start(g_capturePattern);
 }
 
 void clear()
 {
-    glDeleteProgram(g_program);
+    g_simulation.stop();
+    g_frameCapture.clear(); // the frames in flight need the context
+    g_textureResidency.clear();
+    g_shaderReloader.stop();
+    g_shaders.clear();
+    g_atmosphere.clear();
+    g_occlusionCulling.clear();
+    g_clusteredLights.clear();
+    g_dynamicResolution.clear();
+    g_cameraBuffer.clear();
+    g_virtualTextures.clear();
+    if (g_headless) {
+        g_headlessContext.destroy();
+        return;
+    }
     glfwDestroyWindow(g_window);
     glfwTerminate();
 }
@@ -666,64 +1400,343 @@ void render()
     glDrawElements(GL_TRIANGLES, g_triangleIndices.size(), GL_UNSIGNED_INT, 0); // Call for rendering: stream the current GPU geometry through the current GPU program
 }
 
-// Update any accessible variable based on the current time
-void update(const float currentTimeInSec)
+// Computes the transforms of the bodies and the positions of the lights at a time, on the
+// simulation thread: only reads the scene set up by init()
+void simulate(const double currentTimeInSec, SimulationState &state)
 {
-    float rotationAngleEarth = (currentTimeInSec / T) * 360.0f;
-    float orbitAngleEarth = (currentTimeInSec / (2*T)) * 360.0f;
-    float rotationAngleMoon = (currentTimeInSec / (T/2)) * 360.0f;
-    float orbitAngleMoon = rotationAngleMoon;
-    try {
-        std::shared_ptr<Mesh> Earth = meshes[0];
-        std::shared_ptr<Mesh> Moon = meshes[1];
-
-        glm::mat4 modelMatrix = glm::mat4(1.0f);
-        glm::mat4 orbitRotationEarth = glm::rotate(glm::mat4(1.0f), glm::radians(orbitAngleEarth), glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::mat4 tiltMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(-23.5f), glm::vec3(0.0f, 0.0f, 1.0f));
-        glm::vec4 originalYAxis = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f); 
-        glm::vec4 tiltedAxis = tiltMatrix * originalYAxis;
-
-        glm::mat4 earthRotate = glm::rotate(glm::mat4(1.0f), glm::radians(rotationAngleEarth), glm::vec3(tiltedAxis.x, tiltedAxis.y, tiltedAxis.z));
-        glm::mat4 modelMatrixEarth = orbitRotationEarth * glm::translate(modelMatrix, Earth->getTranslation());
-        Earth->setModelMatrix(modelMatrixEarth*earthRotate);
-        //glm::vec3 tn = Earth->testNoraml();
-        //std::cout << "normal: (" << tn.x << ", " << tn.y << ", " << tn.z << ")" << std::endl;
-        glm::mat4 moonRotate = glm::rotate(glm::mat4(1.0f), glm::radians(rotationAngleMoon), glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::mat4 orbitRotationMoon = glm::rotate(glm::mat4(1.0f), glm::radians(orbitAngleMoon), glm::vec3(0.0f, 1.0f, 0.0f));
-        glm::mat4 modelMatrixMoon = modelMatrixEarth * orbitRotationMoon * glm::translate(glm::mat4(1.0f), glm::vec3(2.0, 0.0, 0.0)) * moonRotate;
-        Moon->setModelMatrix(modelMatrixMoon);
-        //Earth->setOrbitRotation(glm::rotate(glm::mat4(1.0f), glm::radians(orbitAngleEarth), glm::vec3(0.0f, 1.0f, 0.0f)));
-        //Moon->setOrbitRotation(glm::rotate(glm::mat4(1.0f), glm::radians(orbitAngleMoon), glm::vec3(0.0f, 1.0f, 0.0f)));
+    // in double precision, the GPU only gets the transforms relative to the camera
+    double rotationAngleEarth = (currentTimeInSec / T) * 360.0;
+    double orbitAngleEarth = (currentTimeInSec / (2*T)) * 360.0;
+    double rotationAngleMoon = (currentTimeInSec / (T/2)) * 360.0;
+    double orbitAngleMoon = rotationAngleMoon;
+    state.transforms.resize(kNumTransforms);
+    state.points.resize(g_lightOrbits.size());
+
+    glm::dmat4 modelMatrix = glm::dmat4(1.0);
+    glm::dmat4 orbitRotationEarth = glm::rotate(glm::dmat4(1.0), glm::radians(orbitAngleEarth), glm::dvec3(0.0, 1.0, 0.0));
+    glm::dmat4 tiltMatrix = glm::rotate(glm::dmat4(1.0), glm::radians(-23.5), glm::dvec3(0.0, 0.0, 1.0));
+    glm::dvec4 originalYAxis = glm::dvec4(0.0, 1.0, 0.0, 0.0); 
+    glm::dvec4 tiltedAxis = tiltMatrix * originalYAxis;
+
+    glm::dmat4 earthRotate = glm::rotate(glm::dmat4(1.0), glm::radians(rotationAngleEarth), glm::dvec3(tiltedAxis.x, tiltedAxis.y, tiltedAxis.z));
+    glm::dmat4 modelMatrixEarth = orbitRotationEarth * glm::translate(modelMatrix, meshes[0]->getTranslation());
+    state.transforms[kTransformEarth] = modelMatrixEarth*earthRotate;
+    state.transforms[kTransformEarthOrbit] = modelMatrixEarth;
+    glm::dmat4 moonRotate = glm::rotate(glm::dmat4(1.0), glm::radians(rotationAngleMoon), glm::dvec3(0.0, 1.0, 0.0));
+    glm::dmat4 orbitRotationMoon = glm::rotate(glm::dmat4(1.0), glm::radians(orbitAngleMoon), glm::dvec3(0.0, 1.0, 0.0));
+    state.transforms[kTransformMoon] = modelMatrixEarth * orbitRotationMoon * glm::translate(glm::dmat4(1.0), glm::dvec3(2.0, 0.0, 0.0)) * moonRotate;
+
+    // satellites on inclined circular orbits around the Earth
+    const glm::dvec3 earthPosition = glm::dvec3(modelMatrixEarth[3]);
+    for (size_t i = 0; i < g_lightOrbits.size(); i++) {
+        const glm::dvec4 orbit = glm::dvec4(g_lightOrbits[i]);
+        const double angle = orbit.z + orbit.y * currentTimeInSec;
+        const glm::dvec3 p = orbit.x * glm::dvec3(std::cos(angle), 0.0, std::sin(angle));
+        state.points[i] = earthPosition + glm::dvec3(glm::rotate(glm::dmat4(1.0), orbit.w, glm::dvec3(1.0, 0.0, 0.0)) * glm::dvec4(p, 1.0));
     }
-    catch (const std::exception& e) {
-        std::cerr << e.what() << std::endl;
+}
 
+// Moves the scene to a simulated state
+void update(const SimulationState &state)
+{
+    meshes[0]->setModelMatrix(state.transforms[kTransformEarth]);
+    meshes[1]->setModelMatrix(state.transforms[kTransformMoon]);
+    if (g_atmosphereShell)
+        g_atmosphereShell->setModelMatrix(state.transforms[kTransformEarthOrbit]);
+    g_lightPositions = state.points;
+}
+
+// Reads the command line options
+void parseArguments(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        try {
+            if (arg == "--vram-budget-mb" && i + 1 < argc) {
+                const long long megabytes = std::stoll(argv[++i]); // std::stoul would take "-1"
+                if (megabytes < 0 || static_cast<unsigned long long>(megabytes) > SIZE_MAX / (1024 * 1024))
+                    throw std::out_of_range(arg);
+                g_textureResidency.setBudget(static_cast<size_t>(megabytes) * 1024 * 1024);
+            }
+            else if (arg == "--texture-tier" && i + 1 < argc) {
+                if (!parseTier(argv[++i], g_textureTier))
+                    std::cerr << "WARNING: unknown texture tier " << argv[i] << ", expected low, medium or 8k" << std::endl;
+                else
+                    g_forceTextureTier = true;
+            }
+            else if (arg == "--texture-array") {
+                g_useTextureArray = true;
+            }
+            else if (arg == "--sky-face-size" && i + 1 < argc) {
+                const int faceSize = std::stoi(argv[++i]);
+                if (faceSize < 0)
+                    throw std::out_of_range(arg);
+                g_skyFaceSize = faceSize;
+            }
+            else if (arg == "--sky-equirect") {
+                g_useSkyCubemap = false;
+            }
+            else if (arg == "--no-program-cache") {
+                g_useProgramCache = false;
+            }
+            else if (arg == "--dynamic-resolution") {
+                g_useDynamicResolution = true;
+            }
+            else if (arg == "--gpu-budget-ms" && i + 1 < argc) {
+                const double budgetMs = std::stod(argv[++i]);
+                if (!(budgetMs > 0.0)) // also NaN
+                    throw std::out_of_range(arg);
+                g_dynamicResolution.setBudgetMs(budgetMs);
+            }
+            else if (arg == "--resolution-scale" && i + 2 < argc) {
+                const float minScale = std::stof(argv[++i]);
+                const float maxScale = std::stof(argv[++i]);
+                if (!(minScale > 0.f) || !(maxScale > 0.f))
+                    throw std::out_of_range(arg);
+                g_dynamicResolution.setScaleRange(minScale, maxScale);
+            }
+            else if (arg == "--no-reverse-z") {
+                g_reverseZ = false;
+            }
+            else if (arg == "--no-occlusion-culling") {
+                g_useOcclusionCulling = false;
+            }
+            else if (arg == "--no-atmosphere") {
+                g_useAtmosphere = false;
+            }
+            else if (arg == "--lights" && i + 1 < argc) {
+                const int numLights = std::stoi(argv[++i]);
+                if (numLights < 0)
+                    throw std::out_of_range(arg);
+                g_numLights = numLights;
+            }
+            else if (arg == "--asset-pack" && i + 1 < argc) {
+                g_assetPackFile = argv[++i];
+            }
+            else if (arg == "--watch-shaders") {
+                g_watchShaders = true;
+            }
+            else if (arg == "--virtual-textures") {
+                g_useVirtualTextures = true;
+            }
+            else if (arg == "--max-fps" && i + 1 < argc) {
+                const double fps = std::stod(argv[++i]);
+                if (!(fps >= 0.0)) // 0 is uncapped; also NaN
+                    throw std::out_of_range(arg);
+                g_maxFps = fps;
+            }
+            else if (arg == "--background-fps" && i + 1 < argc) {
+                const double fps = std::stod(argv[++i]);
+                if (!(fps >= 0.0))
+                    throw std::out_of_range(arg);
+                g_backgroundFps = fps;
+            }
+            else if (arg == "--simulation-rate" && i + 1 < argc) {
+                const double rate = std::stod(argv[++i]);
+                if (!(rate > 0.0)) // also NaN, which std::max would let through
+                    throw std::out_of_range(arg);
+                g_simulationRate = std::max(rate, 1.0);
+            }
+            else if (arg == "--present" && i + 1 < argc) {
+                if (!parsePresentMode(argv[++i], g_presentMode))
+                    std::cerr << "WARNING: unknown present mode " << argv[i] << ", expected vsync, adaptive, uncapped or capped" << std::endl;
+            }
+            else if (arg == "--frame-deadline") {
+                g_frameDeadline = true;
+            }
+            else if (arg == "--persistent-camera") {
+                g_persistentCamera = true;
+            }
+            else if (arg == "--headless") {
+                g_headless = true;
+            }
+            else if (arg == "--frames" && i + 1 < argc) {
+                const int frames = std::stoi(argv[++i]);
+                if (frames < 1)
+                    throw std::out_of_range(arg);
+                g_headlessFrames = frames;
+            }
+            else if (arg == "--size" && i + 2 < argc) {
+                const int width = std::stoi(argv[++i]);
+                const int height = std::stoi(argv[++i]);
+                if (width < 1 || height < 1)
+                    throw std::out_of_range(arg);
+                g_headlessWidth = width;
+                g_headlessHeight = height;
+            }
+            else if (arg == "--output" && i + 1 < argc) {
+                g_outputFile = argv[++i];
+            }
+            else if (arg == "--capture" && i + 1 < argc) {
+                g_capturePattern = argv[++i];
+            }
+            else if (arg == "--on-demand") {
+                g_onDemand = true;
+            }
+            else if (arg == "--startup-target-ms" && i + 1 < argc) {
+                const double targetMs = std::stod(argv[++i]);
+                if (!(targetMs >= 0.0)) // also NaN
+                    throw std::out_of_range(arg);
+                g_startupTargetMs = targetMs;
+            }
+            else {
+                std::cerr << "WARNING: unknown option " << arg << std::endl;
+            }
+        }
+        catch (const std::exception &) { // a value that is not a number, or out of range
+            std::cerr << "WARNING: invalid value for " << arg << std::endl;
+        }
     }
-    // std::cout << currentTimeInSec << std::endl;
 }
 
 int main(int argc, char **argv)
 {  
+    parseArguments(argc, argv);
+    if (!g_assetPackFile.empty()) {
+        // the pack holds the paths relative to the repository root, the app runs from build/
+        std::unique_ptr<AssetPack> pack(new AssetPack());
+        if (pack->open(g_assetPackFile))
+            mountAssetPack(std::move(pack), "../");
+    }
     init(); // Your initialization code (user interface, OpenGL states, scene with geometry, material, lights, etc)
-    while (!glfwWindowShouldClose(g_window))
+    int frames = 0;
+    while (g_headless ? frames < g_headlessFrames : !glfwWindowShouldClose(g_window))
     {
-        update(static_cast<float>(glfwGetTime()));
+        if (!g_headless && glfwGetWindowAttrib(g_window, GLFW_ICONIFIED)) {
+            // nothing is visible: no frame until the window is restored
+            glfwWaitEventsTimeout(kIdleWaitSeconds);
+            g_shaderReloader.update(g_shaders);
+            g_framePacing.idle();
+            continue;
+        }
+        if (g_onDemand && g_paused && !g_redraw && !anyMoveKeyPressed()) {
+            // the last frame is still right, unless pages or shaders arrived in the background
+            glfwWaitEventsTimeout(kIdleWaitSeconds);
+            g_redraw = !g_virtualTextures.empty() || g_watchShaders;
+            g_framePacing.idle();
+            continue;
+        }
+        g_redraw = false;
+        g_framePacing.beginFrame();
+        g_cameraBuffer.beginFrame();
+        g_frameOrigin = g_camera.getPosition();
+        g_cameraBuffer.write(cameraBlock(g_frameOrigin));
+        if (g_simulation.sample(g_simulationState))
+            update(g_simulationState);
         //render();
+        if (!g_virtualTextures.empty()) {
+            // pages seen last frame are requested, loaded ones enter the cache, then the
+            // feedback pass records what this frame needs
+            int width, height;
+            getWindowSize(width, height);
+            g_virtualTextures.update(g_frameIndex);
+            g_virtualTextures.beginFeedback();
+            glDisable(GL_CULL_FACE);
+            for (const auto &mesh : meshes) {
+                if (mesh->getVirtualTexture() >= 0)
+                    mesh->render(true);
+            }
+            glEnable(GL_CULL_FACE);
+            g_virtualTextures.endFeedback(width, height);
+        }
+        if (!g_cameraBuffer.isPersistent())
+            latchCamera();
+        int renderWidth, renderHeight;
+        getWindowSize(renderWidth, renderHeight);
+        // the headless framebuffer is only the output: the scene is always drawn in g_dynamicResolution
+        const bool offscreen = g_useDynamicResolution || g_reverseZ || g_headless;
+        if (offscreen) {
+            int width, height;
+            getFramebufferSize(width, height);
+            g_dynamicResolution.resize(width, height);
+            g_dynamicResolution.begin();
+            renderWidth = g_dynamicResolution.getRenderWidth();
+            renderHeight = g_dynamicResolution.getRenderHeight();
+        }
+        if (!g_lights.empty()) {
+            for (size_t i = 0; i < g_lights.size(); i++)
+                g_lights[i].position = g_camera.toCameraRelative(g_lightPositions[i]);
+            g_clusteredLights.update(g_lights, g_camera.computeViewMatrix(), g_camera.getFov(), g_camera.getAspectRatio(),
+                                     g_camera.getNear(), g_camera.getFar(), renderWidth, renderHeight);
+        }
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         auto sky = meshes[meshes.size() - 1];
         glDisable(GL_CULL_FACE);
         sky->render();
         glEnable(GL_CULL_FACE);
         glCullFace(GL_BACK);
+        if (g_useTextureArray) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, g_albedoArray);
+        }
+        // camera-relative bounding spheres of the bodies, all but the sky; the frustum test
+        // allows for the moves the late latch may still apply
+        const glm::mat4 viewMatrix = g_camera.computeViewMatrix();
+        const glm::mat4 projMatrix = g_camera.computeProjectionMatrix();
+        const float latchMargin = g_cameraBuffer.isPersistent() ? 2.f * cameraSpeed : 0.f;
+        std::vector<glm::vec4> spheres;
+        g_frustumCulling.clear();
         for (size_t i = 0; i < meshes.size() - 1; i++) {
+            const glm::vec3 center = g_camera.toCameraRelative(glm::dvec3(meshes[i]->getModelMatrix()[3]));
+            spheres.push_back(glm::vec4(center, meshes[i]->getRadius()));
+            g_frustumCulling.add(center, meshes[i]->getRadius() + latchMargin);
+        }
+        glm::vec4 planes[6];
+        extractFrustumPlanes(projMatrix * viewMatrix, g_camera.hasZeroToOneDepth(), planes);
+        for (const uint32_t i : g_frustumCulling.cull(planes)) {
             auto mesh = meshes[i];
+            if (g_useOcclusionCulling)
+                g_occlusionCulling.beginDraw(static_cast<int>(i));
             mesh->render();
+            if (g_useOcclusionCulling)
+                g_occlusionCulling.endDraw();
         }
-        checkKey();
-     
+        if (g_atmosphereShell) {
+            // the light of the air is added over the bodies; from inside the shell its back
+            // faces are the visible ones, and everything else is seen through the air
+            const glm::dvec3 earthPosition = glm::dvec3(g_atmosphereShell->getModelMatrix()[3]);
+            const bool inside = glm::length(g_camera.getPosition() - earthPosition) < g_atmosphereShell->getRadius();
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glDepthMask(GL_FALSE);
+            if (inside) {
+                glCullFace(GL_FRONT);
+                glDisable(GL_DEPTH_TEST);
+            }
+            g_atmosphereShell->render();
+            glEnable(GL_DEPTH_TEST);
+            glCullFace(GL_BACK);
+            glDepthMask(GL_TRUE);
+            glDisable(GL_BLEND);
+        }
+        if (g_useOcclusionCulling) {
+            // visibility of the bodies for the next frame, against the complete depth buffer
+            g_occlusionCulling.testSpheres(spheres, g_shaders.get(kShaderEmissive), g_camera.getNear());
+        }
+        if (offscreen)
+            g_dynamicResolution.end(); // bilinear upscale to the window
+        if (g_cameraBuffer.isPersistent())
+            latchCamera();
+        g_cameraBuffer.endFrame();
+        g_shaderReloader.update(g_shaders);
+        g_textureResidency.update(g_frameIndex++);
+        if (g_frameCapture.isActive()) {
+            int width, height;
+            getFramebufferSize(width, height);
+            g_frameCapture.capture(g_headless ? g_headlessContext.getFramebuffer() : 0, width, height);
+        }
+        g_frameCapture.update(); // the readbacks of earlier frames
    
-        glfwSwapBuffers(g_window);
-        glfwPollEvents();
+        g_framePacing.present();
+        frames++;
+        if (!g_headless)
+            glfwPollEvents();
+        g_frameLimiter.wait();
+    }
+    if (g_headless) {
+        g_framePacing.printStats();
+        if (!g_outputFile.empty() && g_headlessContext.savePPM(g_outputFile))
+            std::cout << "frame " << frames << " saved to " << g_outputFile << std::endl;
     }
     clear();
     return EXIT_SUCCESS;
@@ -0,0 +1,108 @@
+#include "occlusionCulling.h"
+
+#include <cmath>
+
+#include <glm/ext.hpp>
+
+namespace {
+
+const float kMargin = 1.1f; // box inflation, for the movement between two frames
+
+} // namespace
+
+void OcclusionCulling::clear()
+{
+    if (!m_queries.empty())
+        glDeleteQueries(static_cast<GLsizei>(m_queries.size()), m_queries.data());
+    m_queries.clear();
+    m_issued.clear();
+    if (m_vao != 0) {
+        glDeleteBuffers(1, &m_vbo);
+        glDeleteBuffers(1, &m_ibo);
+        glDeleteVertexArrays(1, &m_vao);
+    }
+    m_vao = m_vbo = m_ibo = 0;
+}
+
+void OcclusionCulling::init()
+{
+    const float positions[] = {-1, -1, -1,  1, -1, -1,  1, 1, -1,  -1, 1, -1,
+                               -1, -1, 1,   1, -1, 1,   1, 1, 1,   -1, 1, 1};
+    const unsigned int indices[] = {0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+                                    3, 6, 2, 3, 7, 6,  0, 4, 7, 0, 7, 3,  1, 2, 6, 1, 6, 5};
+    glGenVertexArrays(1, &m_vao);
+    glBindVertexArray(m_vao);
+    glGenBuffers(1, &m_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+    glEnableVertexAttribArray(0);
+    glGenBuffers(1, &m_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
+
+void OcclusionCulling::beginDraw(int id)
+{
+    m_conditional = id < static_cast<int>(m_issued.size()) && m_issued[id];
+    if (m_conditional)
+        glBeginConditionalRender(m_queries[id], GL_QUERY_NO_WAIT);
+}
+
+void OcclusionCulling::endDraw()
+{
+    if (m_conditional)
+        glEndConditionalRender();
+    m_conditional = false;
+}
+
+void OcclusionCulling::testSpheres(const std::vector<glm::vec4> &spheres, GLuint program, float nearPlane)
+{
+    if (m_vao == 0)
+        init();
+    if (m_queries.size() < spheres.size()) {
+        const size_t first = m_queries.size();
+        m_queries.resize(spheres.size());
+        m_issued.resize(spheres.size(), false);
+        glGenQueries(static_cast<GLsizei>(spheres.size() - first), &m_queries[first]);
+    }
+
+    // the results that drove this frame, when the GPU has them already
+    m_tested = m_culled = 0;
+    for (size_t i = 0; i < m_issued.size(); i++) {
+        if (!m_issued[i])
+            continue;
+        GLuint available = 0, visible = 0;
+        glGetQueryObjectuiv(m_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        glGetQueryObjectuiv(m_queries[i], GL_QUERY_RESULT, &visible);
+        m_tested++;
+        if (!visible)
+            m_culled++;
+    }
+
+    glUseProgram(program);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    glBindVertexArray(m_vao);
+    for (size_t i = 0; i < spheres.size(); i++) {
+        const glm::vec3 center = glm::vec3(spheres[i]);
+        const float halfSize = spheres[i].w * kMargin;
+        // a box reaching the camera is not rasterized where it should be: always drawn
+        m_issued[i] = glm::length(center) > halfSize * std::sqrt(3.f) + nearPlane;
+        if (!m_issued[i])
+            continue;
+        const glm::mat4 modelMatrix = glm::scale(glm::translate(glm::mat4(1.f), center), glm::vec3(halfSize));
+        glUniformMatrix4fv(glGetUniformLocation(program, "modelMat"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, m_queries[i]);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+    }
+    glBindVertexArray(0);
+    glEnable(GL_CULL_FACE);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
@@ -0,0 +1,43 @@
+#ifndef OCCLUSION_CULLING_H
+#define OCCLUSION_CULLING_H
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Occlusion culling of the bodies against the depth of the previous frame. Once a frame is
+// drawn, the box around the bounding sphere of every body is rasterized (without color or
+// depth writes) inside a GL_ANY_SAMPLES_PASSED query, and the next frame draws the body under
+// glBeginConditionalRender with that query: the GPU skips the vertex and fragment work of the
+// hidden bodies and the CPU never waits for a result (GL_QUERY_NO_WAIT, a result not ready yet
+// means drawn). A body coming out from behind another may appear one frame late; the boxes
+// are inflated to hide it for moderate movements.
+class OcclusionCulling {
+public:
+    // Wrap the draw of object id, conditional on its query of the previous frame if there is one.
+    void beginDraw(int id);
+    void endDraw();
+    // Issues the queries of the next frame, against the depth buffer bound now. spheres are the
+    // camera-relative centers and radii of the objects, by id; program is any program of
+    // vertexShader.glsl, it takes the camera from the bound Camera block.
+    void testSpheres(const std::vector<glm::vec4> &spheres, GLuint program, float nearPlane);
+    // Deletes the queries and the cube, while the context is current.
+    void clear();
+
+    // Debug counters, for the last frame: conditional draws whose query result is known, and
+    // how many of them the GPU skipped
+    inline int getTestedDraws() const { return m_tested; }
+    inline int getCulledDraws() const { return m_culled; }
+
+private:
+    void init();
+
+    GLuint m_vao = 0, m_vbo = 0, m_ibo = 0; // unit cube
+    std::vector<GLuint> m_queries;
+    std::vector<bool> m_issued;             // the query of the object holds its visibility
+    bool m_conditional = false;             // inside beginDraw / endDraw with a query
+    int m_tested = 0, m_culled = 0;
+};
+
+#endif // OCCLUSION_CULLING_H
@@ -0,0 +1,595 @@
+#include "parallelJpeg.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int kMaxComponents = 3;
+
+const uint8_t kDezigzag[64 + 16] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+    // corrupt streams may run past the end of the block
+    63, 63, 63, 63, 63, 63, 63, 63,
+    63, 63, 63, 63, 63, 63, 63, 63};
+
+// Canonical huffman table, with a 9-bit direct lookup for the frequent short codes
+struct Huffman {
+    static const int kFastBits = 9;
+    uint8_t fastLength[1 << kFastBits]; // 0 means "not in the fast table"
+    uint8_t fastSymbol[1 << kFastBits];
+    uint8_t values[256];
+    int maxCode[18];                    // largest code of each length, -1 if none
+    int delta[17];                      // index of values[] minus first code, per length
+    bool defined = false;
+
+    bool build(const uint8_t counts[16], const uint8_t *symbols, int numSymbols) {
+        std::memset(fastLength, 0, sizeof(fastLength));
+        std::memcpy(values, symbols, numSymbols);
+        int code = 0, k = 0;
+        for (int len = 1; len <= 16; len++) {
+            delta[len] = k - code;
+            if (code + counts[len - 1] > (1 << len)) return false; // over-subscribed table
+            for (int i = 0; i < counts[len - 1]; i++, k++, code++) {
+                if (len <= kFastBits) {
+                    const int first = code << (kFastBits - len);
+                    for (int j = 0; j < (1 << (kFastBits - len)); j++) {
+                        fastLength[first + j] = (uint8_t)len;
+                        fastSymbol[first + j] = (uint8_t)k;
+                    }
+                }
+            }
+            maxCode[len] = counts[len - 1] ? code - 1 : -1;
+            code <<= 1;
+        }
+        maxCode[17] = 0x7fffffff;
+        defined = true;
+        return true;
+    }
+};
+
+// Reads the entropy coded data MSB first, skipping 0xFF00 stuffing and feeding zeros
+// once a marker is reached. Its whole state can be saved and restored, which is what
+// lets the pre-scan hand MCU rows over to other threads.
+struct BitReader {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    uint32_t buffer = 0;
+    int count = 0;
+    bool hitMarker = false;
+
+    void fill() {
+        while (count <= 24) {
+            uint32_t b = 0;
+            if (!hitMarker && pos < size) {
+                b = data[pos];
+                if (b == 0xFF) {
+                    const uint8_t next = pos + 1 < size ? data[pos + 1] : 0xD9;
+                    if (next == 0x00) pos += 2;
+                    else { hitMarker = true; b = 0; }
+                } else {
+                    pos++;
+                }
+            }
+            buffer |= b << (24 - count);
+            count += 8;
+        }
+    }
+    inline int decode(const Huffman &h) {
+        if (count < 16) fill();
+        const int peek = buffer >> (32 - Huffman::kFastBits);
+        int len = h.fastLength[peek];
+        if (len) {
+            buffer <<= len;
+            count -= len;
+            return h.values[h.fastSymbol[peek]];
+        }
+        for (len = Huffman::kFastBits + 1; len <= 16; len++) {
+            const int code = buffer >> (32 - len);
+            if (code <= h.maxCode[len]) {
+                buffer <<= len;
+                count -= len;
+                return h.values[(code + h.delta[len]) & 0xFF];
+            }
+        }
+        return -1; // corrupt stream
+    }
+    inline int receiveExtend(int s) {
+        if (s == 0) return 0;
+        if (count < s) fill();
+        int v = (int)(buffer >> (32 - s));
+        buffer <<= s;
+        count -= s;
+        if (v < (1 << (s - 1))) v += 1 - (1 << s);
+        return v;
+    }
+    inline void skip(int s) {
+        if (count < s) fill();
+        buffer <<= s;
+        count -= s;
+    }
+};
+
+// A run of MCUs that can be decoded independently of the others
+struct Segment {
+    BitReader reader;
+    int dcPred[kMaxComponents] = {0, 0, 0};
+    int firstMcu = 0;
+    int numMcus = 0;
+};
+
+struct Component {
+    int id = 0;
+    int h = 1, v = 1;          // sampling factors
+    int tq = 0;                // quantization table
+    int td = 0, ta = 0;        // huffman tables
+    int width = 0, height = 0; // actual size of the component in pixels
+    int stride = 0;            // padded width of the plane
+    std::vector<uint8_t> plane;
+};
+
+struct JpegFrame {
+    int width = 0, height = 0;
+    int numComponents = 0;
+    Component comps[kMaxComponents];
+    uint16_t quant[4][64];
+    Huffman dc[4], ac[4];
+    int hMax = 1, vMax = 1;
+    int mcusX = 0, mcusY = 0;
+    int restartInterval = 0;
+    int adobeTransform = -1;
+    bool jfif = false;
+    const uint8_t *scan = nullptr; // entropy coded data, up to the end of the buffer
+    size_t scanSize = 0;
+};
+
+inline int readU16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+inline uint8_t clamp8(int x) {
+    if ((unsigned)x > 255) return x < 0 ? 0 : 255;
+    return (uint8_t)x;
+}
+
+bool parseHeaders(const uint8_t *buf, size_t size, JpegFrame &f) {
+    if (size < 4 || buf[0] != 0xFF || buf[1] != 0xD8) return false;
+    size_t pos = 2;
+    bool haveFrame = false;
+    while (pos + 4 <= size) {
+        if (buf[pos] != 0xFF) return false;
+        const uint8_t marker = buf[pos + 1];
+        if (marker == 0xFF) { pos++; continue; } // fill bytes
+        const int len = readU16(buf + pos + 2);
+        const uint8_t *p = buf + pos + 4;
+        const uint8_t *end = buf + pos + 2 + len;
+        if (len < 2 || pos + 2 + len > size) return false;
+
+        if (marker == 0xDB) { // DQT
+            while (p < end) {
+                const int pq = *p >> 4, tq = *p & 15;
+                p++;
+                if (pq > 1 || tq > 3 || p + (pq ? 128 : 64) > end) return false;
+                for (int i = 0; i < 64; i++) {
+                    f.quant[tq][kDezigzag[i]] = pq ? (uint16_t)readU16(p + 2 * i) : p[i];
+                }
+                p += pq ? 128 : 64;
+            }
+        }
+        else if (marker == 0xC4) { // DHT
+            while (p + 17 <= end) {
+                const int tc = *p >> 4, th = *p & 15;
+                uint8_t counts[16];
+                int n = 0;
+                for (int i = 0; i < 16; i++) { counts[i] = p[1 + i]; n += counts[i]; }
+                p += 17;
+                if (tc > 1 || th > 3 || n > 256 || p + n > end) return false;
+                Huffman &h = tc == 0 ? f.dc[th] : f.ac[th];
+                if (!h.build(counts, p, n)) return false;
+                p += n;
+            }
+        }
+        else if (marker == 0xC0 || marker == 0xC1) { // SOF0/SOF1, baseline/extended huffman
+            if (len < 8 || p[0] != 8) return false;
+            f.height = readU16(p + 1);
+            f.width = readU16(p + 3);
+            f.numComponents = p[5];
+            if (f.width == 0 || f.height == 0) return false; // DNL is not supported
+            if (f.numComponents != 1 && f.numComponents != 3) return false;
+            if (len < 8 + 3 * f.numComponents) return false;
+            for (int i = 0; i < f.numComponents; i++) {
+                Component &c = f.comps[i];
+                c.id = p[6 + 3 * i];
+                c.h = p[7 + 3 * i] >> 4;
+                c.v = p[7 + 3 * i] & 15;
+                c.tq = p[8 + 3 * i];
+                if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4 || c.tq > 3) return false;
+                f.hMax = std::max(f.hMax, c.h);
+                f.vMax = std::max(f.vMax, c.v);
+            }
+            haveFrame = true;
+        }
+        else if ((marker >= 0xC2 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            return false; // progressive, lossless, arithmetic...
+        }
+        else if (marker == 0xDD) { // DRI
+            if (len < 4) return false;
+            f.restartInterval = readU16(p);
+        }
+        else if (marker == 0xE0) { // APP0
+            f.jfif = len >= 7 && std::memcmp(p, "JFIF", 4) == 0;
+        }
+        else if (marker == 0xEE) { // APP14
+            if (len >= 14 && std::memcmp(p, "Adobe", 5) == 0) f.adobeTransform = p[11];
+        }
+        else if (marker == 0xDA) { // SOS
+            if (!haveFrame) return false;
+            if (len < 3) return false;
+            const int ns = p[0];
+            if (ns != f.numComponents || len < 3 + 2 * ns) return false; // non-interleaved multi-scan baseline is not handled
+            for (int i = 0; i < ns; i++) {
+                const int id = p[1 + 2 * i];
+                int which = -1;
+                for (int c = 0; c < f.numComponents; c++) if (f.comps[c].id == id) which = c;
+                if (which < 0) return false;
+                f.comps[which].td = p[2 + 2 * i] >> 4;
+                f.comps[which].ta = p[2 + 2 * i] & 15;
+                if (f.comps[which].td > 3 || f.comps[which].ta > 3) return false;
+                if (!f.dc[f.comps[which].td].defined || !f.ac[f.comps[which].ta].defined) return false;
+            }
+            f.scan = end;
+            f.scanSize = size - (end - buf);
+            break;
+        }
+        else if (marker == 0xD9) {
+            return false;
+        }
+        pos += 2 + len;
+    }
+    if (!f.scan) return false;
+
+    if (f.numComponents == 1) {
+        // a single component scan is not interleaved, MCUs are single blocks
+        f.comps[0].h = f.comps[0].v = 1;
+        f.hMax = f.vMax = 1;
+    }
+    f.mcusX = (f.width + 8 * f.hMax - 1) / (8 * f.hMax);
+    f.mcusY = (f.height + 8 * f.vMax - 1) / (8 * f.vMax);
+    for (int i = 0; i < f.numComponents; i++) {
+        Component &c = f.comps[i];
+        c.width = (f.width * c.h + f.hMax - 1) / f.hMax;
+        c.height = (f.height * c.v + f.vMax - 1) / f.vMax;
+        c.stride = f.mcusX * c.h * 8;
+    }
+    return true;
+}
+
+// Decodes one block in natural order, already dequantized.
+inline bool decodeBlock(BitReader &br, const Huffman &dc, const Huffman &ac, const uint16_t *q, int &dcPred, short out[64]) {
+    std::memset(out, 0, 64 * sizeof(short));
+    const int t = br.decode(dc);
+    if (t < 0 || t > 16) return false;
+    dcPred += br.receiveExtend(t);
+    out[0] = (short)(dcPred * q[0]);
+    for (int k = 1; k < 64;) {
+        const int rs = br.decode(ac);
+        if (rs < 0) return false;
+        const int r = rs >> 4, s = rs & 15;
+        if (s == 0) {
+            if (r != 15) break; // end of block
+            k += 16;
+            continue;
+        }
+        k += r;
+        const int zig = kDezigzag[k++];
+        out[zig] = (short)(br.receiveExtend(s) * q[zig]);
+    }
+    return true;
+}
+
+// Same walk as decodeBlock, only keeping track of the DC predictor.
+inline bool skipBlock(BitReader &br, const Huffman &dc, const Huffman &ac, int &dcPred) {
+    const int t = br.decode(dc);
+    if (t < 0 || t > 16) return false;
+    dcPred += br.receiveExtend(t);
+    for (int k = 1; k < 64;) {
+        const int rs = br.decode(ac);
+        if (rs < 0) return false;
+        const int r = rs >> 4, s = rs & 15;
+        if (s == 0) {
+            if (r != 15) break;
+            k += 16;
+            continue;
+        }
+        k += r + 1;
+        br.skip(s);
+    }
+    return true;
+}
+
+// Integer IDCT (the "islow" algorithm from the IJG library), constants are 12-bit fixed point.
+#define FIX(x) ((int)((x) * 4096 + 0.5))
+#define IDCT_1D(s0, s1, s2, s3, s4, s5, s6, s7)                                    \
+    int t0, t1, t2, t3, p1, p2, p3, p4, p5, x0, x1, x2, x3;                        \
+    p2 = s2; p3 = s6;                                                              \
+    p1 = (p2 + p3) * FIX(0.5411961f);                                              \
+    t2 = p1 + p3 * FIX(-1.847759065f);                                             \
+    t3 = p1 + p2 * FIX(0.765366865f);                                              \
+    p2 = s0; p3 = s4;                                                              \
+    t0 = (p2 + p3) * 4096;                                                         \
+    t1 = (p2 - p3) * 4096;                                                         \
+    x0 = t0 + t3; x3 = t0 - t3; x1 = t1 + t2; x2 = t1 - t2;                        \
+    t0 = s7; t1 = s5; t2 = s3; t3 = s1;                                            \
+    p3 = t0 + t2; p4 = t1 + t3; p1 = t0 + t3; p2 = t1 + t2;                        \
+    p5 = (p3 + p4) * FIX(1.175875602f);                                            \
+    t0 = t0 * FIX(0.298631336f); t1 = t1 * FIX(2.053119869f);                      \
+    t2 = t2 * FIX(3.072711026f); t3 = t3 * FIX(1.501321110f);                      \
+    p1 = p5 + p1 * FIX(-0.899976223f); p2 = p5 + p2 * FIX(-2.562915447f);          \
+    p3 = p3 * FIX(-1.961570560f); p4 = p4 * FIX(-0.390180644f);                    \
+    t3 += p1 + p4; t2 += p2 + p3; t1 += p2 + p4; t0 += p1 + p3;
+
+void idctBlock(uint8_t *out, int stride, const short in[64]) {
+    int tmp[64];
+    for (int i = 0; i < 8; i++) {
+        const short *d = in + i;
+        int *v = tmp + i;
+        if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[32] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0) {
+            const int dcterm = d[0] * 4;
+            for (int k = 0; k < 8; k++) v[8 * k] = dcterm;
+            continue;
+        }
+        IDCT_1D(d[0], d[8], d[16], d[24], d[32], d[40], d[48], d[56])
+        x0 += 512; x1 += 512; x2 += 512; x3 += 512;
+        v[0] = (x0 + t3) >> 10;  v[56] = (x0 - t3) >> 10;
+        v[8] = (x1 + t2) >> 10;  v[48] = (x1 - t2) >> 10;
+        v[16] = (x2 + t1) >> 10; v[40] = (x2 - t1) >> 10;
+        v[24] = (x3 + t0) >> 10; v[32] = (x3 - t0) >> 10;
+    }
+    for (int i = 0; i < 8; i++, out += stride) {
+        const int *v = tmp + 8 * i;
+        IDCT_1D(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7])
+        // 1<<17 of scaling to remove, with rounding and the +128 level shift
+        x0 += 65536 + (128 << 17); x1 += 65536 + (128 << 17);
+        x2 += 65536 + (128 << 17); x3 += 65536 + (128 << 17);
+        out[0] = clamp8((x0 + t3) >> 17); out[7] = clamp8((x0 - t3) >> 17);
+        out[1] = clamp8((x1 + t2) >> 17); out[6] = clamp8((x1 - t2) >> 17);
+        out[2] = clamp8((x2 + t1) >> 17); out[5] = clamp8((x2 - t1) >> 17);
+        out[3] = clamp8((x3 + t0) >> 17); out[4] = clamp8((x3 - t0) >> 17);
+    }
+}
+#undef IDCT_1D
+#undef FIX
+
+// Decodes the MCUs of a segment straight into the component planes.
+bool decodeSegment(JpegFrame &f, Segment &seg) {
+    short block[64];
+    BitReader &br = seg.reader;
+    for (int m = seg.firstMcu; m < seg.firstMcu + seg.numMcus; m++) {
+        const int mx = m % f.mcusX, my = m / f.mcusX;
+        for (int i = 0; i < f.numComponents; i++) {
+            Component &c = f.comps[i];
+            for (int by = 0; by < c.v; by++) {
+                for (int bx = 0; bx < c.h; bx++) {
+                    if (!decodeBlock(br, f.dc[c.td], f.ac[c.ta], f.quant[c.tq], seg.dcPred[i], block)) return false;
+                    const int px = (mx * c.h + bx) * 8, py = (my * c.v + by) * 8;
+                    idctBlock(c.plane.data() + (size_t)py * c.stride + px, c.stride, block);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Restart markers make every interval independent: finding them only needs a byte scan.
+bool splitAtRestartMarkers(const JpegFrame &f, std::vector<Segment> &segments) {
+    const int totalMcus = f.mcusX * f.mcusY;
+    const int numIntervals = (totalMcus + f.restartInterval - 1) / f.restartInterval;
+    segments.reserve(numIntervals);
+    size_t start = 0;
+    for (size_t i = 0; i + 1 < f.scanSize && (int)segments.size() < numIntervals;) {
+        if (f.scan[i] != 0xFF) {
+            const void *ff = std::memchr(f.scan + i, 0xFF, f.scanSize - 1 - i);
+            if (!ff) break;
+            i = (const uint8_t *)ff - f.scan;
+            continue;
+        }
+        const uint8_t m = f.scan[i + 1];
+        const bool isRestart = m >= 0xD0 && m <= 0xD7;
+        if (isRestart || m == 0xD9) {
+            Segment seg;
+            seg.reader.data = f.scan + start;
+            seg.reader.size = i - start;
+            seg.firstMcu = (int)segments.size() * f.restartInterval;
+            seg.numMcus = std::min(f.restartInterval, totalMcus - seg.firstMcu);
+            segments.push_back(seg);
+            start = i + 2;
+            if (m == 0xD9) break;
+        }
+        i += (m == 0xFF) ? 1 : 2;
+    }
+    if ((int)segments.size() == numIntervals - 1 && start < f.scanSize) {
+        // last interval without a trailing marker (truncated file)
+        Segment seg;
+        seg.reader.data = f.scan + start;
+        seg.reader.size = f.scanSize - start;
+        seg.firstMcu = (int)segments.size() * f.restartInterval;
+        seg.numMcus = totalMcus - seg.firstMcu;
+        segments.push_back(seg);
+    }
+    return (int)segments.size() == numIntervals;
+}
+
+// True when the entropy coded data has RSTn markers, even without a DRI segment.
+bool hasRestartMarkers(const JpegFrame &f) {
+    for (size_t i = 0; i + 1 < f.scanSize;) {
+        const void *ff = std::memchr(f.scan + i, 0xFF, f.scanSize - 1 - i);
+        if (!ff) return false;
+        i = (const uint8_t *)ff - f.scan;
+        if (f.scan[i + 1] >= 0xD0 && f.scan[i + 1] <= 0xD7) return true;
+        i += (f.scan[i + 1] == 0xFF) ? 1 : 2;
+    }
+    return false;
+}
+
+// Without restart markers the bit position of a MCU row is only known once the
+// previous rows were huffman decoded: walk the stream once without storing any
+// coefficient and save the reader state at the start of every row. The walk ignores
+// restart markers (they reset the DC predictions), so it must only see streams that
+// have none.
+bool splitAtMcuRows(const JpegFrame &f, std::vector<Segment> &segments) {
+    BitReader br;
+    br.data = f.scan;
+    br.size = f.scanSize;
+    int dcPred[kMaxComponents] = {0, 0, 0};
+    segments.resize(f.mcusY);
+    for (int my = 0; my < f.mcusY; my++) {
+        Segment &seg = segments[my];
+        seg.reader = br;
+        std::copy(dcPred, dcPred + kMaxComponents, seg.dcPred);
+        seg.firstMcu = my * f.mcusX;
+        seg.numMcus = f.mcusX;
+        if (my == f.mcusY - 1) break; // the last row does not need to be walked
+        for (int mx = 0; mx < f.mcusX; mx++) {
+            for (int i = 0; i < f.numComponents; i++) {
+                const Component &c = f.comps[i];
+                for (int b = 0; b < c.h * c.v; b++) {
+                    if (!skipBlock(br, f.dc[c.td], f.ac[c.ta], dcPred[i])) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Runs job(i) for i in [0, count) on up to numThreads threads, the calling one included.
+template <typename Job>
+void parallelFor(int count, unsigned int numThreads, const Job &job) {
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int i = next++; i < count; i = next++) job(i);
+    };
+    const unsigned int n = std::min<unsigned int>(numThreads, (unsigned int)std::max(count, 1));
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < n; t++) threads.emplace_back(worker);
+    worker();
+    for (auto &t : threads) t.join();
+}
+
+// Returns row y of a component at full resolution. Subsampled chroma goes through the
+// triangle ("fancy") upsampling filter into tmp; positions are in 1/16 of a sample.
+const uint8_t *upsampleRow(const Component &c, int y, int width, int hMax, int vMax, uint8_t *tmp) {
+    if (c.h == hMax && c.v == vMax) return c.plane.data() + (size_t)y * c.stride;
+    const int sy = std::max(0, ((2 * y + 1) * c.v * 8) / vMax - 8); // (y + 0.5) * v / vMax - 0.5
+    const int y0 = std::min(sy >> 4, c.height - 1), y1 = std::min(y0 + 1, c.height - 1);
+    const int fy = sy & 15;
+    const uint8_t *r0 = c.plane.data() + (size_t)y0 * c.stride;
+    const uint8_t *r1 = c.plane.data() + (size_t)y1 * c.stride;
+    for (int x = 0; x < width; x++) {
+        const int sx = std::max(0, ((2 * x + 1) * c.h * 8) / hMax - 8);
+        const int x0 = std::min(sx >> 4, c.width - 1), x1 = std::min(x0 + 1, c.width - 1);
+        const int fx = sx & 15;
+        const int top = r0[x0] * (16 - fx) + r0[x1] * fx;
+        const int bottom = r1[x0] * (16 - fx) + r1[x1] * fx;
+        tmp[x] = (uint8_t)((top * (16 - fy) + bottom * fy + 128) >> 8);
+    }
+    return tmp;
+}
+
+// YCbCr to RGB factors, 20-bit fixed point (same conversion as stb_image)
+const int kCrToR = (int)(1.40200f * 4096.0f + 0.5f) << 8;
+const int kCrToG = (int)(0.71414f * 4096.0f + 0.5f) << 8;
+const int kCbToG = (int)(0.34414f * 4096.0f + 0.5f) << 8;
+const int kCbToB = (int)(1.77200f * 4096.0f + 0.5f) << 8;
+
+void convertRows(const JpegFrame &f, int y0, int y1, bool ycbcr, uint8_t *out, size_t stride) {
+    std::vector<uint8_t> tmp(3 * (size_t)f.width);
+    for (int y = y0; y < y1; y++) {
+        uint8_t *o = out + (size_t)y * stride;
+        const uint8_t *c0 = upsampleRow(f.comps[0], y, f.width, f.hMax, f.vMax, tmp.data());
+        if (f.numComponents == 1) {
+            std::memcpy(o, c0, f.width);
+            continue;
+        }
+        const uint8_t *c1 = upsampleRow(f.comps[1], y, f.width, f.hMax, f.vMax, tmp.data() + f.width);
+        const uint8_t *c2 = upsampleRow(f.comps[2], y, f.width, f.hMax, f.vMax, tmp.data() + 2 * f.width);
+        if (!ycbcr) {
+            for (int x = 0; x < f.width; x++, o += 3) { o[0] = c0[x]; o[1] = c1[x]; o[2] = c2[x]; }
+            continue;
+        }
+        for (int x = 0; x < f.width; x++, o += 3) {
+            const int yFixed = (c0[x] << 20) + (1 << 19);
+            const int cb = c1[x] - 128, cr = c2[x] - 128;
+            const int r = yFixed + cr * kCrToR;
+            const int g = yFixed - cr * kCrToG + ((-cb * kCbToG) & 0xffff0000);
+            const int b = yFixed + cb * kCbToB;
+            o[0] = clamp8(r >> 20);
+            o[1] = clamp8(g >> 20);
+            o[2] = clamp8(b >> 20);
+        }
+    }
+}
+
+} // namespace
+
+bool readJpegInfo(const unsigned char *buffer, size_t size,
+                  int &width, int &height, int &numComponents)
+{
+    JpegFrame frame;
+    if (!parseHeaders(buffer, size, frame)) return false;
+    width = frame.width;
+    height = frame.height;
+    numComponents = frame.numComponents;
+    return true;
+}
+
+bool decodeJpegParallel(const unsigned char *buffer, size_t size,
+                        unsigned char *dst, size_t stride,
+                        unsigned int numThreads)
+{
+    JpegFrame frame;
+    if (!parseHeaders(buffer, size, frame)) return false;
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (stride == 0) stride = (size_t)frame.width * frame.numComponents;
+    for (int i = 0; i < frame.numComponents; i++) {
+        Component &c = frame.comps[i];
+        c.plane.resize((size_t)c.stride * frame.mcusY * c.v * 8);
+    }
+
+    // 1. split the entropy coded data in independent segments
+    // (a stream the splitters cannot handle is left to the single-threaded decoders)
+    std::vector<Segment> segments;
+    if (frame.restartInterval > 0) {
+        if (!splitAtRestartMarkers(frame, segments)) return false;
+    }
+    else if (hasRestartMarkers(frame) || !splitAtMcuRows(frame, segments)) {
+        return false;
+    }
+
+    // 2. huffman decoding + IDCT of all the segments, in parallel
+    std::atomic<bool> ok(true);
+    parallelFor((int)segments.size(), numThreads, [&](int i) {
+        if (ok && !decodeSegment(frame, segments[i])) ok = false;
+    });
+    if (!ok) return false;
+
+    // 3. upsampling and color conversion, by bands of rows, straight into dst
+    const bool ycbcr = frame.numComponents == 3 && frame.adobeTransform != 0 &&
+        !(frame.comps[0].id == 'R' && frame.comps[1].id == 'G' && frame.comps[2].id == 'B');
+    const int kRowsPerBand = 32;
+    const int height = frame.height;
+    const int numBands = (height + kRowsPerBand - 1) / kRowsPerBand;
+    parallelFor(numBands, numThreads, [&](int band) {
+        convertRows(frame, band * kRowsPerBand, std::min(height, (band + 1) * kRowsPerBand), ycbcr, dst, stride);
+    });
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef PARALLEL_JPEG_H
+#define PARALLEL_JPEG_H
+
+#include <cstddef>
+
+// Multi-threaded decoder for baseline (sequential, huffman coded, 8-bit) JPEG files.
+// The entropy coded data is split into independent segments, either at the restart
+// markers when the file has a restart interval, or at MCU rows found by a fast
+// entropy pre-scan. Segments are then huffman decoded + IDCT'd on all cores, and
+// the color conversion is split by pixel rows.
+// Anything else (progressive, arithmetic coding, CMYK, 12-bit...) is rejected so
+// that the caller can fall back to another decoder.
+
+// Reads the image size, returns false if the decoder does not handle this file.
+// numComponents is 1 for grayscale, 3 for RGB.
+bool readJpegInfo(const unsigned char *buffer, size_t size,
+                  int &width, int &height, int &numComponents);
+
+// Decodes a JPEG held in memory into dst, whose rows are stride bytes apart
+// (0 means tightly packed). numThreads = 0 means all cores.
+bool decodeJpegParallel(const unsigned char *buffer, size_t size,
+                        unsigned char *dst, size_t stride = 0,
+                        unsigned int numThreads = 0);
+
+#endif // PARALLEL_JPEG_H
@@ -0,0 +1,125 @@
+#include "programCache.h"
+
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "glExtensions.h"
+
+namespace {
+
+// Cache file header, followed by the binary
+struct ProgramCacheHeader {
+    char magic[4];    // "PBC1"
+    uint32_t format;  // binary format returned by glGetProgramBinary
+    uint32_t length;
+};
+
+// FNV-1a
+uint64_t hashBytes(uint64_t h, const char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+std::string glString(GLenum name)
+{
+    const GLubyte *s = glGetString(name);
+    return s != nullptr ? reinterpret_cast<const char *>(s) : "";
+}
+
+} // namespace
+
+void ProgramCache::init()
+{
+    GLint formats = 0;
+    if (glGetProgramBinary != nullptr && glProgramBinary != nullptr && glProgramParameteri != nullptr)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    m_supported = formats > 0;
+    m_enabled = m_supported;
+    m_driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+    if (m_supported)
+        mkdir(m_directory.c_str(), 0755);
+    else
+        std::cout << "program binaries not supported by the driver, shaders are always compiled" << std::endl;
+}
+
+uint64_t ProgramCache::key(const std::vector<std::string> &sources) const
+{
+    uint64_t h = 14695981039346656037ull;
+    h = hashBytes(h, m_driver.data(), m_driver.size() + 1);
+    for (const std::string &source : sources)
+        h = hashBytes(h, source.data(), source.size() + 1); // the terminating zeros separate the sources
+    return h;
+}
+
+std::string ProgramCache::path(uint64_t key) const
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return m_directory + name;
+}
+
+bool ProgramCache::load(uint64_t key, GLuint program) const
+{
+    if (!m_enabled)
+        return false;
+    std::ifstream file(path(key).c_str(), std::ios::binary | std::ios::ate);
+    const std::streamoff fileSize = file.tellg();
+    file.seekg(0);
+    ProgramCacheHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || std::memcmp(header.magic, "PBC1", 4) != 0)
+        return false;
+    // a truncated or corrupt file must not make us allocate whatever its header says
+    if (header.length == 0 || header.length != fileSize - static_cast<std::streamoff>(sizeof(header)))
+        return false;
+    std::vector<char> binary(header.length);
+    if (!file.read(binary.data(), binary.size()))
+        return false;
+    glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    return linked == GL_TRUE;
+}
+
+void ProgramCache::prepare(GLuint program) const
+{
+    if (m_enabled)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+void ProgramCache::store(uint64_t key, GLuint program) const
+{
+    GLint linked = GL_FALSE, length = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!m_enabled || linked != GL_TRUE)
+        return;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    // written aside and renamed, so that a concurrent or interrupted run never reads a truncated binary
+    const std::string filename = path(key);
+    const std::string tmpFilename = filename + ".tmp";
+    {
+        std::ofstream file(tmpFilename.c_str(), std::ios::binary);
+        ProgramCacheHeader header = {{'P', 'B', 'C', '1'}, format, static_cast<uint32_t>(length)};
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(binary.data(), length);
+        if (!file) {
+            std::cerr << "WARNING: could not write the program cache " << filename << std::endl;
+            std::remove(tmpFilename.c_str());
+            return;
+        }
+    }
+    std::rename(tmpFilename.c_str(), filename.c_str());
+}
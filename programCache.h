@@ -0,0 +1,41 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+// On-disk cache of linked GPU programs (glGetProgramBinary), so that warm starts skip the
+// compilation and linking of every shader permutation. A program is keyed by a hash of its
+// complete sources (defines included) and of the driver vendor, renderer and version:
+// changing a shader or updating the driver simply misses the cache. A binary the driver
+// rejects is a miss too, the caller then compiles from source.
+class ProgramCache {
+public:
+    explicit ProgramCache(const std::string &directory) : m_directory(directory) {}
+
+    // Checks the driver support, to be called once the GL extensions are loaded.
+    void init();
+    inline bool isEnabled() const { return m_enabled; }
+    inline void setEnabled(bool enabled) { m_enabled = enabled && m_supported; }
+
+    uint64_t key(const std::vector<std::string> &sources) const;
+    // Loads the cached binary into program. Returns false on a miss.
+    bool load(uint64_t key, GLuint program) const;
+    // To be called before glLinkProgram on a program that will be stored.
+    void prepare(GLuint program) const;
+    // Saves a successfully linked program.
+    void store(uint64_t key, GLuint program) const;
+
+private:
+    std::string path(uint64_t key) const;
+
+    std::string m_directory;
+    std::string m_driver;      // vendor, renderer and version strings
+    bool m_supported = false;
+    bool m_enabled = false;
+};
+
+#endif // PROGRAM_CACHE_H
@@ -0,0 +1,65 @@
+#include "shaderPermutations.h"
+
+
+namespace {
+
+const struct {
+    uint32_t feature;
+    const char *define;
+} kFeatureDefines[] = {
+    {kShaderLit, "LIT"},
+    {kShaderEmissive, "EMISSIVE"},
+    {kShaderSky, "SKY"},
+    {kShaderAlbedoArray, "ALBEDO_ARRAY"},
+    {kShaderSkyCubemap, "SKY_CUBEMAP"},
+    {kShaderVirtualTexture, "VIRTUAL_TEXTURE"},
+    {kShaderVtFeedback, "VT_FEEDBACK"},
+    {kShaderClusteredLights, "CLUSTERED_LIGHTS"},
+    {kShaderAtmosphere, "ATMOSPHERE"},
+    {kShaderAtmosphereShell, "ATMOSPHERE_SHELL"},
+};
+
+} // namespace
+
+std::string ShaderPermutations::defines(uint32_t features)
+{
+    std::string lines;
+    for (const auto &f : kFeatureDefines) {
+        if (features & f.feature)
+            lines += std::string("#define ") + f.define + "\n";
+    }
+    return lines;
+}
+
+GLuint ShaderPermutations::get(uint32_t features)
+{
+    auto it = m_programs.find(features);
+    if (it != m_programs.end())
+        return it->second;
+    const GLuint program = m_build(defines(features));
+    m_programs[features] = program;
+    return program;
+}
+
+std::vector<uint32_t> ShaderPermutations::featureSets() const
+{
+    std::vector<uint32_t> sets;
+    for (const auto &p : m_programs)
+        sets.push_back(p.first);
+    return sets;
+}
+
+void ShaderPermutations::replace(uint32_t features, GLuint program)
+{
+    GLuint &current = m_programs[features];
+    if (current != 0)
+        glDeleteProgram(current); // deletion is deferred while the program is still in use
+    current = program;
+}
+
+void ShaderPermutations::clear()
+{
+    for (const auto &p : m_programs)
+        glDeleteProgram(p.second);
+    m_programs.clear();
+}
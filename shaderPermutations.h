@@ -0,0 +1,55 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Features of a shader permutation. Each one is a #define of the shader sources, so a
+// program only contains the code of the features it was built with.
+// Material, exactly one of:
+const uint32_t kShaderLit = 1 << 0;             // LIT: Phong shading from lightPos
+const uint32_t kShaderEmissive = 1 << 1;        // EMISSIVE: light sources, albedo only
+const uint32_t kShaderSky = 1 << 2;             // SKY: background sphere, albedo only
+// Albedo source, at most one of (a sampler2D by default):
+const uint32_t kShaderAlbedoArray = 1 << 3;     // ALBEDO_ARRAY: layer of a texture array
+const uint32_t kShaderSkyCubemap = 1 << 4;      // SKY_CUBEMAP: cubemap sampled by direction
+const uint32_t kShaderVirtualTexture = 1 << 5;  // VIRTUAL_TEXTURE: tiled virtual texture
+// Pass:
+const uint32_t kShaderVtFeedback = 1 << 6;      // VT_FEEDBACK: virtual texture page requests
+// Lighting:
+const uint32_t kShaderClusteredLights = 1 << 7; // CLUSTERED_LIGHTS: local point lights, with LIT
+// Atmosphere (see atmosphere.h):
+const uint32_t kShaderAtmosphere = 1 << 8;      // ATMOSPHERE: LIT ground lit and seen through the air
+const uint32_t kShaderAtmosphereShell = 1 << 9; // ATMOSPHERE_SHELL: material of the shell around it, the
+                                                // light scattered along the view ray, added to the image
+
+// Variants of the GPU program built on demand from the same sources, one per feature set,
+// and kept for the whole run. The renderer selects the variant of every draw.
+class ShaderPermutations {
+public:
+    // Compiles and links the program for a set of #define lines
+    typedef std::function<GLuint(const std::string &)> BuildFunction;
+
+    explicit ShaderPermutations(const BuildFunction &build) : m_build(build) {}
+
+    static std::string defines(uint32_t features);
+    // Program of a feature set, built the first time it is asked for.
+    GLuint get(uint32_t features);
+    inline size_t size() const { return m_programs.size(); }
+    std::vector<uint32_t> featureSets() const;
+    // Swaps in a new program for a feature set (e.g. after a shader edit), deleting the old one.
+    void replace(uint32_t features, GLuint program);
+    // Deletes every variant.
+    void clear();
+
+private:
+    BuildFunction m_build;
+    std::map<uint32_t, GLuint> m_programs;
+};
+
+#endif // SHADER_PERMUTATIONS_H
@@ -0,0 +1,158 @@
+#include "shaderReloader.h"
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <set>
+
+namespace {
+
+// Editors often write a file in several steps: the rebuild waits for the changes to settle
+const std::chrono::milliseconds kSettleDelay(150);
+const int kPollTimeoutMs = 50;
+
+void splitPath(const std::string &path, std::string &dir, std::string &name)
+{
+    const size_t slash = path.find_last_of('/');
+    dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+} // namespace
+
+ShaderReloader::~ShaderReloader()
+{
+    m_quit = true;
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+bool ShaderReloader::start(GLFWwindow *window, const std::vector<std::string> &files, const ShaderPermutations::BuildFunction &build)
+{
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cerr << "ERROR: inotify is not available, shaders will not be reloaded" << std::endl;
+        return false;
+    }
+    // the directories are watched rather than the files, which editors often replace by a rename
+    std::set<std::string> dirs;
+    std::vector<std::string> names;
+    for (const std::string &file : files) {
+        std::string dir, name;
+        splitPath(file, dir, name);
+        names.push_back(name);
+        if (dirs.insert(dir).second && inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+            std::cerr << "ERROR: cannot watch " << dir << std::endl;
+    }
+
+    // invisible window whose context shares the objects of the main one
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    m_context = glfwCreateWindow(1, 1, "shader reloader", nullptr, window);
+    glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+    if (m_context == nullptr) {
+        std::cerr << "ERROR: could not create the shader compilation context" << std::endl;
+        close(fd);
+        return false;
+    }
+    m_build = build;
+    m_quit = false;
+    m_thread = std::thread(&ShaderReloader::run, this, fd, names);
+    std::cout << "watching the shader sources for changes" << std::endl;
+    return true;
+}
+
+void ShaderReloader::stop()
+{
+    m_quit = true;
+    if (m_thread.joinable())
+        m_thread.join();
+    if (m_context != nullptr) {
+        glfwDestroyWindow(m_context);
+        m_context = nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (Result &r : m_results) {
+        for (GLuint program : r.programs)
+            glDeleteProgram(program);
+        glDeleteSync(r.fence);
+    }
+    m_results.clear();
+}
+
+void ShaderReloader::run(int inotifyFd, std::vector<std::string> names)
+{
+    glfwMakeContextCurrent(m_context);
+    bool pending = false;
+    std::chrono::steady_clock::time_point lastChange;
+    alignas(inotify_event) char buffer[4096];
+    while (!m_quit) {
+        pollfd pfd = {inotifyFd, POLLIN, 0};
+        if (poll(&pfd, 1, kPollTimeoutMs) > 0) {
+            ssize_t size;
+            while ((size = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char *p = buffer; p < buffer + size;) {
+                    const inotify_event *event = reinterpret_cast<const inotify_event *>(p);
+                    if (event->len > 0 && std::find(names.begin(), names.end(), std::string(event->name)) != names.end()) {
+                        pending = true;
+                        lastChange = std::chrono::steady_clock::now();
+                    }
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+        }
+        if (pending && std::chrono::steady_clock::now() - lastChange >= kSettleDelay) {
+            pending = false;
+            rebuild();
+        }
+    }
+    close(inotifyFd);
+    glfwMakeContextCurrent(nullptr);
+}
+
+void ShaderReloader::rebuild()
+{
+    Result result;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        result.features = m_featureSets;
+    }
+    std::cout << "shader sources changed, rebuilding " << result.features.size() << " permutations" << std::endl;
+    for (uint32_t features : result.features)
+        result.programs.push_back(m_build(ShaderPermutations::defines(features)));
+    // the render thread may only use the programs once this context is done with them
+    result.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_results.push_back(result);
+}
+
+void ShaderReloader::update(ShaderPermutations &shaders)
+{
+    if (m_context == nullptr)
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_featureSets = shaders.featureSets();
+    while (!m_results.empty()) {
+        Result &r = m_results.front();
+        const GLenum status = glClientWaitSync(r.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(r.fence);
+        int failed = 0;
+        for (size_t i = 0; i < r.features.size(); i++) {
+            if (r.programs[i] != 0)
+                shaders.replace(r.features[i], r.programs[i]);
+            else
+                failed++;
+        }
+        if (failed > 0)
+            std::cerr << "ERROR: " << failed << " shader permutations failed to build, keeping their previous version" << std::endl;
+        else
+            std::cout << "shaders reloaded" << std::endl;
+        m_results.erase(m_results.begin());
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef SHADER_RELOADER_H
+#define SHADER_RELOADER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "shaderPermutations.h"
+
+// Hot reload of the GLSL sources without frame hitches.
+// A background thread watches the shader files with inotify. When one is saved, it rebuilds
+// every live permutation on its own OpenGL context, shared with the window's, and signals a
+// fence. The render thread keeps drawing with the old programs and, once the fence has
+// passed, swaps in the variants that linked; a variant that fails keeps its old program.
+class ShaderReloader {
+public:
+    ~ShaderReloader();
+
+    // Creates the background context and starts watching. build compiles and links a
+    // permutation on the current context, returning 0 on failure.
+    bool start(GLFWwindow *window, const std::vector<std::string> &files, const ShaderPermutations::BuildFunction &build);
+    // Swaps in the rebuilt programs, to be called once per frame on the render thread.
+    void update(ShaderPermutations &shaders);
+    // Stops watching and destroys the background context, before glfwTerminate.
+    void stop();
+
+private:
+    struct Result {
+        std::vector<uint32_t> features;
+        std::vector<GLuint> programs; // 0 for the variants that failed
+        GLsync fence = nullptr;
+    };
+    void run(int inotifyFd, std::vector<std::string> names);
+    void rebuild();
+
+    GLFWwindow *m_context = nullptr;
+    ShaderPermutations::BuildFunction m_build;
+    std::thread m_thread;
+    std::atomic<bool> m_quit{false};
+
+    std::mutex m_mutex;
+    std::vector<uint32_t> m_featureSets; // permutations in use, updated by the render thread
+    std::vector<Result> m_results;       // built, waiting for their fence
+};
+
+#endif // SHADER_RELOADER_H
@@ -0,0 +1,117 @@
+#include "simulationThread.h"
+
+#include <algorithm>
+
+#include <glm/ext.hpp>
+
+namespace {
+
+const int kMaxLagSteps = 5; // further behind, the simulation slows down instead of catching up
+
+// Interpolates a rotation and translation
+glm::dmat4 interpolateTransform(const glm::dmat4 &a, const glm::dmat4 &b, double t)
+{
+    const glm::dquat rotation = glm::slerp(glm::quat_cast(glm::dmat3(a)), glm::quat_cast(glm::dmat3(b)), t);
+    glm::dmat4 m = glm::mat4_cast(rotation);
+    m[3] = glm::dvec4(glm::mix(glm::dvec3(a[3]), glm::dvec3(b[3]), t), 1.0);
+    return m;
+}
+
+} // namespace
+
+SimulationThread::~SimulationThread()
+{
+    stop();
+}
+
+void SimulationThread::start(double stepSeconds, const StepFunction &step)
+{
+    if (m_thread.joinable())
+        return;
+    m_step = step;
+    m_stepSeconds = stepSeconds;
+    m_period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(stepSeconds));
+    m_quit = false;
+    // the first state is there before start() returns
+    SimulationState initial;
+    m_step(initial.time, initial);
+    publish(initial, initial, Clock::now());
+    m_thread = std::thread(&SimulationThread::run, this, initial);
+}
+
+void SimulationThread::stop()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void SimulationThread::setPaused(bool paused)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_paused = paused;
+    }
+    m_wake.notify_one();
+}
+
+void SimulationThread::publish(const SimulationState &previous, const SimulationState &current, Clock::time_point time)
+{
+    Snapshot &snapshot = m_snapshots.back();
+    snapshot.previous = previous;
+    snapshot.current = current;
+    snapshot.published = time;
+    m_snapshots.publish();
+}
+
+void SimulationThread::run(SimulationState current)
+{
+    SimulationState previous;
+    Clock::time_point scheduled = Clock::now();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        scheduled += m_period;
+        if (m_wake.wait_until(lock, scheduled, [this] { return m_quit || m_paused; })) {
+            m_wake.wait(lock, [this] { return m_quit || !m_paused; });
+            if (m_quit)
+                break;
+            scheduled = Clock::now(); // the pause does not count
+        }
+        const Clock::time_point now = Clock::now();
+        if (now - scheduled > kMaxLagSteps * m_period)
+            scheduled = now;
+        lock.unlock();
+
+        std::swap(previous, current);
+        current.time = previous.time + m_stepSeconds;
+        m_step(current.time, current);
+        publish(previous, current, scheduled);
+        lock.lock();
+    }
+}
+
+bool SimulationThread::sample(SimulationState &state)
+{
+    if (m_snapshots.acquire())
+        m_started = true;
+    if (!m_started)
+        return false;
+    const Snapshot &snapshot = m_snapshots.front();
+    const SimulationState &a = snapshot.previous, &b = snapshot.current;
+    const double elapsed = std::chrono::duration<double>(Clock::now() - snapshot.published).count();
+    const double t = std::min(std::max(elapsed / m_stepSeconds, 0.0), 1.0);
+
+    state.time = a.time + (b.time - a.time) * t;
+    state.transforms.resize(b.transforms.size());
+    for (size_t i = 0; i < b.transforms.size(); i++)
+        state.transforms[i] = interpolateTransform(a.transforms[i], b.transforms[i], t);
+    state.points.resize(b.points.size());
+    for (size_t i = 0; i < b.points.size(); i++)
+        state.points[i] = glm::mix(a.points[i], b.points[i], t);
+    return true;
+}
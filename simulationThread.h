@@ -0,0 +1,66 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "tripleBuffer.h"
+
+// What a simulation step computes: rigid transforms (rotation and translation) and points
+struct SimulationState {
+    double time = 0.0;
+    std::vector<glm::dmat4> transforms;
+    std::vector<glm::dvec3> points;
+};
+
+// Runs a simulation at a fixed timestep on its own thread, so that its cost overlaps the
+// rendering instead of adding to the frame time. Each step publishes the previous and the new
+// state through a TripleBuffer, and the render thread draws one step in the past, interpolating
+// between the two (translations and points linearly, rotations with a slerp): the motion is
+// smooth at any frame rate and neither thread ever waits for the other.
+class SimulationThread {
+public:
+    // Computes the state at a simulation time, from scratch (on the simulation thread)
+    typedef std::function<void(double time, SimulationState &state)> StepFunction;
+
+    ~SimulationThread();
+
+    // Computes the state at time 0, then starts stepping it
+    void start(double stepSeconds, const StepFunction &step);
+    void stop();
+    // The simulation time stops while paused, the thread sleeps
+    void setPaused(bool paused);
+
+    // State at the current time minus one step; false before start()
+    bool sample(SimulationState &state);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Snapshot {
+        SimulationState previous, current;
+        Clock::time_point published; // when current became the latest state
+    };
+
+    void publish(const SimulationState &previous, const SimulationState &current, Clock::time_point time);
+    void run(SimulationState current);
+
+    StepFunction m_step;
+    Clock::duration m_period;
+    double m_stepSeconds = 0.0;
+    std::thread m_thread;
+    TripleBuffer<Snapshot> m_snapshots;
+    bool m_started = false; // the reader has a snapshot
+
+    std::mutex m_mutex;  // m_paused and m_quit, to wake the thread up
+    std::condition_variable m_wake;
+    bool m_paused = false;
+    bool m_quit = false;
+};
+
+#endif // SIMULATION_THREAD_H
@@ -0,0 +1,207 @@
+#include "skyCubemap.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "assetPack.h"
+#include "imageDecoder.h"
+
+namespace {
+
+const float kPi = 3.14159265358979f;
+const int kMaxSupersampling = 4;
+
+// Cache file header, followed by the six faces
+struct CubemapCacheHeader {
+    char magic[4];           // "CUB1"
+    uint32_t faceSize;
+    uint64_t sourceSize;     // the cache is stale when the image file changed
+    int64_t sourceMTime;
+};
+
+bool sourceStamp(const std::string &path, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+// Direction of texel (s, t) in [-1, 1]^2 of a face, see the cube map face selection table of the GL spec
+void faceDirection(int face, float s, float t, float d[3])
+{
+    switch (face) {
+    case 0: d[0] = 1;  d[1] = -t; d[2] = -s; break;
+    case 1: d[0] = -1; d[1] = -t; d[2] = s;  break;
+    case 2: d[0] = s;  d[1] = 1;  d[2] = t;  break;
+    case 3: d[0] = s;  d[1] = -1; d[2] = -t; break;
+    case 4: d[0] = s;  d[1] = -t; d[2] = 1;  break;
+    default: d[0] = -s; d[1] = -t; d[2] = -1; break;
+    }
+}
+
+// Bilinear lookup, wrapping horizontally and clamping vertically
+void sampleEquirect(const unsigned char *rgb, int width, int height, float u, float v, float out[3])
+{
+    const float x = u * width - 0.5f, y = std::min(std::max(v * height - 0.5f, 0.f), height - 1.f);
+    const int x0 = static_cast<int>(std::floor(x)), y0 = static_cast<int>(y);
+    const int y1 = std::min(y0 + 1, height - 1);
+    const float fx = x - x0, fy = y - y0;
+    const int xa = ((x0 % width) + width) % width, xb = (xa + 1) % width;
+    for (int c = 0; c < 3; c++) {
+        const float top = rgb[(y0 * width + xa) * 3 + c] * (1 - fx) + rgb[(y0 * width + xb) * 3 + c] * fx;
+        const float bottom = rgb[(y1 * width + xa) * 3 + c] * (1 - fx) + rgb[(y1 * width + xb) * 3 + c] * fx;
+        out[c] = top * (1 - fy) + bottom * fy;
+    }
+}
+
+void convertFace(const unsigned char *rgb, int width, int height, int faceSize, int face, std::vector<unsigned char> &dst)
+{
+    // supersampled when the face is much coarser than the map, so that small stars do not vanish
+    const int ss = std::min(kMaxSupersampling, std::max(1, static_cast<int>(std::lround(width / (4.0 * faceSize)))));
+    dst.resize(static_cast<size_t>(faceSize) * faceSize * 3);
+    for (int y = 0; y < faceSize; y++) {
+        for (int x = 0; x < faceSize; x++) {
+            float sum[3] = {0, 0, 0};
+            for (int sy = 0; sy < ss; sy++) {
+                for (int sx = 0; sx < ss; sx++) {
+                    const float s = 2.f * (x + (sx + 0.5f) / ss) / faceSize - 1.f;
+                    const float t = 2.f * (y + (sy + 0.5f) / ss) / faceSize - 1.f;
+                    float d[3];
+                    faceDirection(face, s, t, d);
+                    const float len = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+                    // same mapping as the sphere UVs of Mesh::genSphere
+                    const float u = (std::atan2(d[0], d[2]) + kPi) / (2.f * kPi);
+                    const float v = std::acos(std::min(std::max(d[1] / len, -1.f), 1.f)) / kPi;
+                    float texel[3];
+                    sampleEquirect(rgb, width, height, u, v, texel);
+                    for (int c = 0; c < 3; c++)
+                        sum[c] += texel[c];
+                }
+            }
+            for (int c = 0; c < 3; c++)
+                dst[(static_cast<size_t>(y) * faceSize + x) * 3 + c] = static_cast<unsigned char>(sum[c] / (ss * ss) + 0.5f);
+        }
+    }
+}
+
+bool readCache(const std::string &cachePath, int faceSize, uint64_t sourceSize, int64_t sourceMTime, std::vector<unsigned char> faces[6])
+{
+    std::ifstream file(cachePath.c_str(), std::ios::binary);
+    CubemapCacheHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+    if (std::memcmp(header.magic, "CUB1", 4) != 0 || header.faceSize != static_cast<uint32_t>(faceSize)
+        || header.sourceSize != sourceSize || header.sourceMTime != sourceMTime)
+        return false;
+    for (int face = 0; face < 6; face++) {
+        faces[face].resize(static_cast<size_t>(faceSize) * faceSize * 3);
+        if (!file.read(reinterpret_cast<char *>(faces[face].data()), faces[face].size()))
+            return false;
+    }
+    return true;
+}
+
+void writeCache(const std::string &cachePath, int faceSize, uint64_t sourceSize, int64_t sourceMTime, const std::vector<unsigned char> faces[6])
+{
+    // written aside and renamed, so that an interrupted write never leaves a truncated cache
+    const std::string tmpPath = cachePath + ".tmp";
+    {
+        std::ofstream file(tmpPath.c_str(), std::ios::binary);
+        CubemapCacheHeader header = {{'C', 'U', 'B', '1'}, static_cast<uint32_t>(faceSize), sourceSize, sourceMTime};
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (int face = 0; face < 6; face++)
+            file.write(reinterpret_cast<const char *>(faces[face].data()), faces[face].size());
+        if (!file) {
+            std::cerr << "WARNING: could not write the cubemap cache " << cachePath << std::endl;
+            std::remove(tmpPath.c_str());
+            return;
+        }
+    }
+    std::rename(tmpPath.c_str(), cachePath.c_str());
+}
+
+} // namespace
+
+void equirectToCubemap(const unsigned char *rgb, int width, int height, int faceSize, std::vector<unsigned char> faces[6])
+{
+    std::vector<std::thread> threads;
+    for (int face = 0; face < 6; face++)
+        threads.emplace_back(convertFace, rgb, width, height, faceSize, face, std::ref(faces[face]));
+    for (std::thread &t : threads)
+        t.join();
+}
+
+GLuint loadSkyCubemap(const std::string &equirectPath, int faceSize)
+{
+    std::vector<unsigned char> storage;
+    AssetView fileData;
+    ImageInfo info;
+    const ImageDecoder *decoder = nullptr;
+    if (loadAsset(equirectPath, fileData, storage))
+        decoder = findImageDecoder(fileData.data, fileData.size, info);
+    if (decoder == nullptr)
+        return 0;
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &maxSize);
+    if (faceSize <= 0)
+        faceSize = std::max(1, info.width / 4);
+    faceSize = std::min(faceSize, static_cast<int>(maxSize));
+
+    std::vector<unsigned char> faces[6];
+    uint64_t sourceSize = 0;
+    int64_t sourceMTime = 0;
+    const bool stamped = sourceStamp(equirectPath, sourceSize, sourceMTime);
+    const std::string cachePath = equirectPath + "." + std::to_string(faceSize) + ".cube";
+    if (stamped && readCache(cachePath, faceSize, sourceSize, sourceMTime, faces)) {
+        std::cout << "sky cubemap " << faceSize << "x" << faceSize << " read from " << cachePath << std::endl;
+    }
+    else {
+        std::vector<unsigned char> pixels;
+        for (; decoder != nullptr; decoder = findImageDecoder(fileData.data, fileData.size, info, decoder)) {
+            pixels.resize(info.rowSize() * info.height);
+            if (decoder->decode(fileData.data, fileData.size, info, pixels.data(), info.rowSize()))
+                break;
+        }
+        if (decoder == nullptr)
+            return 0;
+        storage.clear();
+        if (info.numComponents != 3) {
+            std::vector<unsigned char> rgb(static_cast<size_t>(info.width) * info.height * 3);
+            for (size_t p = 0; p < rgb.size() / 3; p++)
+                for (int c = 0; c < 3; c++)
+                    rgb[p * 3 + c] = pixels[p * info.numComponents + (info.numComponents < 3 ? 0 : c)];
+            pixels.swap(rgb);
+        }
+        equirectToCubemap(pixels.data(), info.width, info.height, faceSize, faces);
+        std::cout << "sky cubemap " << faceSize << "x" << faceSize << " converted from " << equirectPath << std::endl;
+        if (stamped)
+            writeCache(cachePath, faceSize, sourceSize, sourceMTime, faces);
+    }
+
+    GLuint texID;
+    glGenTextures(1, &texID);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int face = 0; face < 6; face++)
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB8, faceSize, faceSize, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[face].data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    return texID;
+}
@@ -0,0 +1,26 @@
+#ifndef SKY_CUBEMAP_H
+#define SKY_CUBEMAP_H
+
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Resampling of an equirectangular sky map into the six faces of a cubemap.
+// An equirectangular map spends most of its texels near the poles and must be fully
+// resident; a cubemap has a nearly uniform density, so a smaller one gives the same
+// detail, and sampling it by direction is more cache friendly.
+
+// Face i follows the GL_TEXTURE_CUBE_MAP_POSITIVE_X + i conventions, row 0 first. The map
+// orientation matches the UVs of Mesh::genSphere. faces[i] receives faceSize^2 RGB8 texels;
+// the faces are computed in parallel.
+void equirectToCubemap(const unsigned char *rgb, int width, int height, int faceSize, std::vector<unsigned char> faces[6]);
+
+// Creates a mip-mapped cubemap from an equirectangular image file. faceSize 0 keeps the
+// texel density of the map at the equator (width / 4). The faces are cached on disk next
+// to the image, in <image>.<faceSize>.cube, and rebuilt when the image changes (not for
+// images read from the asset pack, which have no file to stamp the cache with).
+// Returns 0 if the image cannot be decoded.
+GLuint loadSkyCubemap(const std::string &equirectPath, int faceSize = 0);
+
+#endif // SKY_CUBEMAP_H
@@ -0,0 +1,295 @@
+#include "textureResidency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+const size_t kBytesPerTexel = 4;          // drivers usually pad RGB8 to RGBA8
+const uint64_t kReleaseAfterFrames = 120; // clamped levels are kept that long before being released
+const uint64_t kVisibleFrames = 2;        // a texture drawn that recently counts as visible
+
+enum { kPending, kDecoded, kFailed };     // TextureResidency::Restore::state
+
+const GLenum kFormats[] = {GL_RGB, GL_RED, GL_RG, GL_RGB, GL_RGBA}; // by number of components
+
+} // namespace
+
+TextureResidency::~TextureResidency()
+{
+    stopWorker(); // the GL objects went with clear()
+}
+
+size_t TextureResidency::levelBytes(const Entry &e, int level) const
+{
+    const size_t w = std::max(1, e.width >> level);
+    const size_t h = std::max(1, e.height >> level);
+    return w * h * kBytesPerTexel;
+}
+
+size_t TextureResidency::bytesFromLevel(const Entry &e, int firstLevel) const
+{
+    size_t bytes = 0;
+    for (int level = firstLevel; level < e.numLevels; level++)
+        bytes += levelBytes(e, level);
+    return bytes;
+}
+
+void TextureResidency::track(GLuint texID, int width, int height, int numComponents, const DecodeFunction &decode)
+{
+    untrack(texID);
+    Entry e;
+    e.width = width;
+    e.height = height;
+    e.numComponents = std::min(std::max(numComponents, 1), 4);
+    while ((std::max(width, height) >> e.numLevels) > 0)
+        e.numLevels++;
+    e.decode = decode;
+    m_residentBytes += bytesFromLevel(e, e.releasedLevels);
+    m_textures[texID] = e;
+}
+
+void TextureResidency::untrack(GLuint texID)
+{
+    auto it = m_textures.find(texID);
+    if (it == m_textures.end())
+        return;
+    if (it->second.restore)
+        finishRestore(texID, it->second, true); // the worker writes into its buffer
+    m_residentBytes -= bytesFromLevel(it->second, it->second.releasedLevels);
+    m_textures.erase(it);
+}
+
+void TextureResidency::touch(GLuint texID, uint64_t frame)
+{
+    auto it = m_textures.find(texID);
+    if (it != m_textures.end())
+        it->second.lastUsedFrame = frame;
+}
+
+void TextureResidency::clear()
+{
+    for (auto &t : m_textures) {
+        if (t.second.restore)
+            finishRestore(t.first, t.second, true);
+    }
+    stopWorker();
+    if (m_copyBuffer != 0) {
+        glDeleteBuffers(1, &m_copyBuffer);
+        m_copyBuffer = 0;
+    }
+    m_textures.clear();
+    m_residentBytes = 0;
+}
+
+void TextureResidency::applyBaseLevel(GLuint texID, const Entry &e) const
+{
+    glBindTexture(GL_TEXTURE_2D, texID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, e.baseLevel - e.releasedLevels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Re-specifies the texture from its current base level: this one becomes level 0 and the
+// old top levels are freed. The kept levels go through a pixel buffer, GPU to GPU, so the
+// CPU never waits for the texture data.
+void TextureResidency::releaseTopLevels(GLuint texID, Entry &e)
+{
+    const int glBase = e.baseLevel - e.releasedLevels;
+    const int newNumLevels = e.numLevels - e.baseLevel;
+    if (m_copyBuffer == 0)
+        glGenBuffers(1, &m_copyBuffer);
+
+    glBindTexture(GL_TEXTURE_2D, texID);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_copyBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, bytesFromLevel(e, e.baseLevel), nullptr, GL_STREAM_COPY);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    size_t offset = 0;
+    for (int level = 0; level < newNumLevels; level++) {
+        glGetTexImage(GL_TEXTURE_2D, glBase + level, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void *>(offset));
+        offset += levelBytes(e, e.baseLevel + level);
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    for (int level = newNumLevels; level < e.numLevels - e.releasedLevels; level++)
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_copyBuffer);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    offset = 0;
+    for (int level = 0; level < newNumLevels; level++) {
+        const int w = std::max(1, e.width >> (e.baseLevel + level));
+        const int h = std::max(1, e.height >> (e.baseLevel + level));
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, reinterpret_cast<void *>(offset));
+        offset += levelBytes(e, e.baseLevel + level);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, newNumLevels - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_residentBytes -= bytesFromLevel(e, e.releasedLevels);
+    e.releasedLevels = e.baseLevel;
+    m_residentBytes += bytesFromLevel(e, e.releasedLevels);
+}
+
+// Brings back the full resolution: at once when the levels are only clamped, otherwise
+// the decode of the image is queued for the worker and finishRestore uploads it.
+void TextureResidency::restore(GLuint texID, Entry &e)
+{
+    if (e.releasedLevels == 0) {
+        e.baseLevel = 0;
+        applyBaseLevel(texID, e);
+        return;
+    }
+    const size_t stride = (static_cast<size_t>(e.width) * e.numComponents + 3) & ~size_t(3); // GL_UNPACK_ALIGNMENT 4
+    glGenBuffers(1, &e.pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, e.pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, stride * e.height, nullptr, GL_STREAM_DRAW);
+    void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, stride * e.height, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    e.restore = std::make_shared<Restore>();
+    e.restore->decode = e.decode;
+    e.restore->dst = static_cast<unsigned char *>(dst);
+    e.restore->stride = stride;
+    if (dst == nullptr) {
+        e.restore->state = kFailed;
+        return;
+    }
+    if (!m_thread.joinable()) {
+        m_quit = false;
+        m_thread = std::thread(&TextureResidency::run, this);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(e.restore);
+    }
+    m_wake.notify_one();
+}
+
+// Uploads a decoded restore from its pixel buffer, or gives up on a failed one.
+void TextureResidency::finishRestore(GLuint texID, Entry &e, bool wait)
+{
+    while (wait && e.restore->state == kPending)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const int state = e.restore->state;
+    if (state == kPending)
+        return;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, e.pbo);
+    const bool unmapped = e.restore->dst == nullptr || glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+    if (state == kDecoded && unmapped) {
+        glBindTexture(GL_TEXTURE_2D, texID);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, e.numLevels - 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, e.width, e.height, 0, kFormats[e.numComponents], GL_UNSIGNED_BYTE, 0);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_residentBytes -= bytesFromLevel(e, e.releasedLevels);
+        e.releasedLevels = 0;
+        e.baseLevel = 0;
+        m_residentBytes += bytesFromLevel(e, e.releasedLevels);
+    }
+    else {
+        std::cerr << "ERROR: texture " << texID << ": could not decode its released levels again" << std::endl;
+        e.decodeFailed = true;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &e.pbo); // the driver keeps the storage alive until the upload is done
+    e.pbo = 0;
+    e.restore.reset();
+}
+
+void TextureResidency::stopWorker()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.clear(); // the restores not started yet are dropped
+        m_quit = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void TextureResidency::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_wake.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+        if (m_queue.empty())
+            break;
+        std::shared_ptr<Restore> r = m_queue.front();
+        m_queue.pop_front();
+        lock.unlock();
+        r->state = r->decode(r->dst, r->stride) ? kDecoded : kFailed;
+        lock.lock();
+    }
+}
+
+void TextureResidency::update(uint64_t frame)
+{
+    // Restores decoded since the last frame
+    for (auto &t : m_textures) {
+        if (t.second.restore)
+            finishRestore(t.first, t.second, false);
+    }
+
+    // Budget taken: a restore in flight counts with its full resolution already
+    size_t used = 0;
+    for (auto &t : m_textures)
+        used += bytesFromLevel(t.second, t.second.restore ? 0 : t.second.baseLevel);
+
+    // Bring back the full resolution of the visible textures, when it fits in the budget
+    for (auto &t : m_textures) {
+        Entry &e = t.second;
+        if (e.baseLevel == 0 || e.restore || frame - e.lastUsedFrame >= kVisibleFrames)
+            continue;
+        if (e.decodeFailed && e.releasedLevels > 0)
+            continue;
+        const size_t extra = bytesFromLevel(e, 0) - bytesFromLevel(e, e.baseLevel);
+        if (used + extra > m_budget)
+            continue;
+        used += extra;
+        restore(t.first, e);
+    }
+
+    // Over budget: clamp the least recently used (then the largest) texture down to its
+    // smallest level before touching the next one, the visible ones come last
+    if (used > m_budget) {
+        std::vector<std::map<GLuint, Entry>::iterator> victims;
+        for (auto it = m_textures.begin(); it != m_textures.end(); ++it) {
+            if (!it->second.restore)
+                victims.push_back(it);
+        }
+        std::sort(victims.begin(), victims.end(), [this](const std::map<GLuint, Entry>::iterator &a, const std::map<GLuint, Entry>::iterator &b) {
+            if (a->second.lastUsedFrame != b->second.lastUsedFrame)
+                return a->second.lastUsedFrame < b->second.lastUsedFrame;
+            return bytesFromLevel(a->second, a->second.baseLevel) > bytesFromLevel(b->second, b->second.baseLevel);
+        });
+        for (auto &it : victims) {
+            Entry &e = it->second;
+            const int baseLevel = e.baseLevel;
+            while (used > m_budget && e.baseLevel < e.numLevels - 1)
+                used -= levelBytes(e, e.baseLevel++);
+            if (e.baseLevel != baseLevel) {
+                e.clampedFrame = frame;
+                applyBaseLevel(it->first, e);
+            }
+            if (used <= m_budget)
+                break;
+        }
+    }
+
+    // Levels clamped long enough are really freed
+    for (auto &t : m_textures) {
+        Entry &e = t.second;
+        if (!e.restore && e.baseLevel > e.releasedLevels && frame - e.clampedFrame >= kReleaseAfterFrames) {
+            releaseTopLevels(t.first, e);
+            std::cout << "texture " << t.first << ": released " << e.releasedLevels << " top mip level(s), "
+                      << m_residentBytes / (1024 * 1024) << " MB resident" << std::endl;
+        }
+    }
+}
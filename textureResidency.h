@@ -0,0 +1,92 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <glad/glad.h>
+
+// Keeps the mip-mapped 2D textures within a VRAM budget.
+// Every tracked texture records its size and the last frame it was drawn in. When the
+// resident total goes over budget, the least recently used textures first get their
+// GL_TEXTURE_BASE_LEVEL raised, so the GPU stops sampling the top mips, and after a grace
+// period the top mips are really released by re-specifying the texture from its smaller
+// levels (copied on the GPU through a pixel buffer). A texture being drawn again gets its
+// levels back as soon as the budget allows; released levels are decoded again on a worker
+// thread, straight into a pixel unpack buffer, and the texture keeps its clamped levels
+// until the upload lands.
+class TextureResidency {
+public:
+    // Decodes the full resolution level of a texture again (e.g. from its file) into dst,
+    // whose rows are stride bytes apart. Called on the worker thread.
+    typedef std::function<bool(unsigned char *dst, size_t stride)> DecodeFunction;
+
+    ~TextureResidency();
+
+    inline void setBudget(size_t bytes) { m_budget = bytes; }
+    inline size_t getBudget() const { return m_budget; }
+    inline size_t getResidentBytes() const { return m_residentBytes; }
+
+    // Starts tracking a texture whose complete mip chain was just uploaded from an image of
+    // numComponents channels (1 to 4).
+    void track(GLuint texID, int width, int height, int numComponents, const DecodeFunction &decode);
+    void untrack(GLuint texID);
+    // Records that the texture is used to draw the given frame.
+    void touch(GLuint texID, uint64_t frame);
+    // Enforces the budget, to be called once per frame.
+    void update(uint64_t frame);
+    // Stops the worker and frees the GL objects, while the context is current.
+    void clear();
+
+private:
+    // A restore in flight: the worker decodes into the mapped pbo
+    struct Restore {
+        DecodeFunction decode;
+        unsigned char *dst = nullptr;
+        size_t stride = 0;
+        std::atomic<int> state{0}; // kPending, kDecoded or kFailed
+    };
+    struct Entry {
+        int width = 0, height = 0;    // size of the full resolution level
+        int numComponents = 3;
+        int numLevels = 1;
+        int baseLevel = 0;            // clamped GL_TEXTURE_BASE_LEVEL, in full resolution level units
+        int releasedLevels = 0;       // top levels no longer allocated
+        uint64_t lastUsedFrame = 0;
+        uint64_t clampedFrame = 0;    // frame at which baseLevel was last raised
+        DecodeFunction decode;
+        bool decodeFailed = false;    // the released levels cannot be brought back
+        GLuint pbo = 0;               // while restoring
+        std::shared_ptr<Restore> restore;
+    };
+
+    size_t levelBytes(const Entry &e, int level) const;
+    size_t bytesFromLevel(const Entry &e, int firstLevel) const; // levels firstLevel..numLevels-1
+    void applyBaseLevel(GLuint texID, const Entry &e) const;
+    void releaseTopLevels(GLuint texID, Entry &e);
+    void restore(GLuint texID, Entry &e);
+    void finishRestore(GLuint texID, Entry &e, bool wait);
+    void stopWorker();
+    void run();
+
+    std::map<GLuint, Entry> m_textures;
+    size_t m_budget = SIZE_MAX;
+    size_t m_residentBytes = 0;
+    GLuint m_copyBuffer = 0;          // kept levels, on their way from the old to the new storage
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::shared_ptr<Restore>> m_queue;
+    bool m_quit = false;
+};
+
+#endif // TEXTURE_RESIDENCY_H
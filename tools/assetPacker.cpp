@@ -0,0 +1,121 @@
+// Builds the asset pack read by AssetPack, see assetPack.h for the layout.
+//
+//   assetPacker <output.pak> <root directory> <file or directory relative to the root>...
+//
+// Directories are packed recursively. Entries are named by their path relative to the root,
+// e.g. "media/earth.jpg" or "fragmentShader.glsl".
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "assetPack.h"
+#include "imageDecoder.h"
+
+namespace {
+
+void listFiles(const std::string &root, const std::string &name, std::vector<std::string> &names)
+{
+    const std::string path = root + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        std::cerr << "WARNING: " << path << " not found" << std::endl;
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        names.push_back(name);
+        return;
+    }
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr)
+        return;
+    while (dirent *d = readdir(dir)) {
+        const std::string child = d->d_name;
+        if (child != "." && child != "..")
+            listFiles(root, name + "/" + child, names);
+    }
+    closedir(dir);
+}
+
+void pad(std::ofstream &out, uint64_t &offset)
+{
+    static const char zeros[kAssetPackAlignment] = {};
+    const uint64_t padding = (kAssetPackAlignment - offset % kAssetPackAlignment) % kAssetPackAlignment;
+    out.write(zeros, padding);
+    offset += padding;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 4) {
+        std::cerr << "usage: " << argv[0] << " <output.pak> <root directory> <file or directory>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string root = argv[2];
+    std::vector<std::string> names;
+    for (int i = 3; i < argc; i++)
+        listFiles(root, argv[i], names);
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    uint32_t tableSize = 1;
+    while (tableSize < names.size() * 2)
+        tableSize *= 2;
+    std::vector<AssetPackEntry> table(tableSize, AssetPackEntry());
+    std::string nameBlock;
+
+    std::ofstream out(argv[1], std::ios::binary);
+    AssetPackHeader header = {{'T', 'P', 'A', 'K'}, 1, static_cast<uint32_t>(names.size()), tableSize, 0};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    uint64_t offset = sizeof(header);
+    uint64_t totalSize = 0, totalStored = 0;
+    std::vector<unsigned char> data, compressed;
+    for (const std::string &name : names) {
+        if (!readBinaryFile(root + "/" + name, data)) {
+            std::cerr << "ERROR: could not read " << name << std::endl;
+            return EXIT_FAILURE;
+        }
+        pad(out, offset);
+        AssetPackEntry e = AssetPackEntry();
+        e.nameHash = hashAssetName(name);
+        e.offset = offset;
+        e.size = data.size();
+        // only kept compressed when it saves at least an eighth
+        e.compressed = compressLz4(data.data(), data.size(), compressed) && compressed.size() < data.size() - data.size() / 8;
+        const std::vector<unsigned char> &stored = e.compressed ? compressed : data;
+        e.storedSize = stored.size();
+        e.nameOffset = static_cast<uint32_t>(nameBlock.size());
+        nameBlock += name;
+        nameBlock += '\0';
+        out.write(reinterpret_cast<const char *>(stored.data()), stored.size());
+        offset += stored.size();
+        totalSize += e.size;
+        totalStored += e.storedSize;
+
+        uint32_t slot = e.nameHash & (tableSize - 1);
+        while (table[slot].nameHash != 0)
+            slot = (slot + 1) & (tableSize - 1);
+        table[slot] = e;
+        std::cout << name << ": " << e.size << " bytes" << (e.compressed ? ", compressed to " + std::to_string(e.storedSize) : "") << std::endl;
+    }
+    pad(out, offset);
+    header.tocOffset = offset;
+    out.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(AssetPackEntry));
+    out.write(nameBlock.data(), nameBlock.size());
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!out) {
+        std::cerr << "ERROR: could not write " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << names.size() << " assets, " << totalSize / 1024 << " KB stored in " << totalStored / 1024 << " KB" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+// Offline step of the virtual texturing: cuts a (very) large map into the mip pyramid of
+// fixed-size pages read by VirtualTexture, see virtualTexture.h for the .vt layout.
+//
+//   vtTiler <input image> <output.vt> [page size = 128] [border = 4]
+//
+// The map is resampled so that it holds a power of two number of pages on each axis.
+// Maps are expected to be equirectangular: borders wrap horizontally and are clamped
+// vertically.
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "imageDecoder.h"
+#include "virtualTexture.h"
+
+struct Image {
+    int width = 0, height = 0;
+    std::vector<unsigned char> rgb;
+    inline const unsigned char *at(int x, int y) const { return &rgb[(static_cast<size_t>(y) * width + x) * 3]; }
+};
+
+static int nearestPowerOfTwo(double x)
+{
+    int p = 1;
+    while (p * 2 <= x * 1.5)
+        p *= 2;
+    return p;
+}
+
+static Image resample(const Image &src, int width, int height)
+{
+    Image dst;
+    dst.width = width;
+    dst.height = height;
+    dst.rgb.resize(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; y++) {
+        const float sy = std::max(0.f, (y + 0.5f) * src.height / height - 0.5f);
+        const int y0 = std::min(static_cast<int>(sy), src.height - 1), y1 = std::min(y0 + 1, src.height - 1);
+        const float fy = sy - y0;
+        for (int x = 0; x < width; x++) {
+            const float sx = std::max(0.f, (x + 0.5f) * src.width / width - 0.5f);
+            const int x0 = std::min(static_cast<int>(sx), src.width - 1), x1 = std::min(x0 + 1, src.width - 1);
+            const float fx = sx - x0;
+            for (int c = 0; c < 3; c++) {
+                const float top = src.at(x0, y0)[c] * (1 - fx) + src.at(x1, y0)[c] * fx;
+                const float bottom = src.at(x0, y1)[c] * (1 - fx) + src.at(x1, y1)[c] * fx;
+                dst.rgb[(static_cast<size_t>(y) * width + x) * 3 + c] = static_cast<unsigned char>(top * (1 - fy) + bottom * fy + 0.5f);
+            }
+        }
+    }
+    return dst;
+}
+
+static Image halve(const Image &src)
+{
+    Image dst;
+    dst.width = src.width / 2;
+    dst.height = src.height / 2;
+    dst.rgb.resize(static_cast<size_t>(dst.width) * dst.height * 3);
+    for (int y = 0; y < dst.height; y++)
+        for (int x = 0; x < dst.width; x++)
+            for (int c = 0; c < 3; c++)
+                dst.rgb[(static_cast<size_t>(y) * dst.width + x) * 3 + c] = static_cast<unsigned char>(
+                    (src.at(2 * x, 2 * y)[c] + src.at(2 * x + 1, 2 * y)[c] + src.at(2 * x, 2 * y + 1)[c] + src.at(2 * x + 1, 2 * y + 1)[c] + 2) / 4);
+    return dst;
+}
+
+int main(int argc, char **argv)
+{
+    const int pageSize = argc > 3 ? std::atoi(argv[3]) : 128;
+    const int border = argc > 4 ? std::atoi(argv[4]) : 4;
+    if (argc < 3 || pageSize <= 0 || border < 0 || border >= pageSize) {
+        std::cerr << "usage: " << argv[0] << " <input image> <output.vt> [page size = 128] [border = 4]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ImageInfo info;
+    std::vector<unsigned char> pixels;
+    if (!decodeImageFile(argv[1], info, pixels)) {
+        std::cerr << "ERROR: could not decode " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    Image image;
+    image.width = info.width;
+    image.height = info.height;
+    image.rgb.resize(static_cast<size_t>(info.width) * info.height * 3);
+    for (size_t p = 0; p < image.rgb.size() / 3; p++)
+        for (int c = 0; c < 3; c++)
+            image.rgb[p * 3 + c] = pixels[p * info.numComponents + (info.numComponents < 3 ? 0 : c)];
+    pixels.clear();
+    pixels.shrink_to_fit();
+
+    VirtualTextureHeader header = {{'V', 'T', 'X', '1'}, 0, 0, 0, 0, 0};
+    header.pageSize = pageSize;
+    header.border = border;
+    header.pagesX = nearestPowerOfTwo(static_cast<double>(image.width) / pageSize);
+    header.pagesY = nearestPowerOfTwo(static_cast<double>(image.height) / pageSize);
+    header.numLevels = 1;
+    while ((std::min(header.pagesX, header.pagesY) >> header.numLevels) > 0)
+        header.numLevels++;
+    if (image.width != static_cast<int>(header.pagesX) * pageSize || image.height != static_cast<int>(header.pagesY) * pageSize)
+        image = resample(image, header.pagesX * pageSize, header.pagesY * pageSize);
+
+    std::ofstream out(argv[2], std::ios::binary);
+    if (!out) {
+        std::cerr << "ERROR: could not create " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    const int pageTexels = pageSize + 2 * border;
+    std::vector<unsigned char> page(static_cast<size_t>(pageTexels) * pageTexels * 3);
+    for (uint32_t level = 0; level < header.numLevels; level++) {
+        const int pagesX = header.pagesX >> level, pagesY = header.pagesY >> level;
+        for (int py = 0; py < pagesY; py++) {
+            for (int px = 0; px < pagesX; px++) {
+                for (int y = 0; y < pageTexels; y++) {
+                    const int sy = std::min(std::max(py * pageSize + y - border, 0), image.height - 1);
+                    for (int x = 0; x < pageTexels; x++) {
+                        const int sx = (px * pageSize + x - border + image.width) % image.width;
+                        std::copy(image.at(sx, sy), image.at(sx, sy) + 3, &page[(static_cast<size_t>(y) * pageTexels + x) * 3]);
+                    }
+                }
+                out.write(reinterpret_cast<const char *>(page.data()), page.size());
+            }
+        }
+        std::cout << "level " << level << ": " << pagesX << "x" << pagesY << " pages" << std::endl;
+        if (level + 1 < header.numLevels)
+            image = halve(image);
+    }
+    if (!out) {
+        std::cerr << "ERROR: could not write " << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
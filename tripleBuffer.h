@@ -0,0 +1,35 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free single producer, single consumer hand-off of the latest value. The writer fills
+// its back slot and publishes it by swapping it with the middle slot; the reader swaps its
+// front slot with the middle one when a new value was published. Neither side ever waits, the
+// reader skips the values it was too slow to see, and each slot is only touched by one side.
+template <typename T>
+class TripleBuffer {
+public:
+    // Writer: the slot to fill, then publish()
+    inline T &back() { return m_slots[m_back]; }
+    inline void publish() { m_back = m_middle.exchange(m_back | kFresh, std::memory_order_acq_rel) & kIndexMask; }
+
+    // Reader: takes the latest published value, returns false when there is none since the last call
+    inline bool acquire() {
+        if (!(m_middle.load(std::memory_order_relaxed) & kFresh))
+            return false;
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & kIndexMask;
+        return true;
+    }
+    inline const T &front() const { return m_slots[m_front]; }
+
+private:
+    static const unsigned kIndexMask = 3;
+    static const unsigned kFresh = 4; // the middle slot holds a value the reader has not taken
+
+    T m_slots[3];
+    unsigned m_front = 0, m_back = 1;
+    std::atomic<unsigned> m_middle{2};
+};
+
+#endif // TRIPLE_BUFFER_H
@@ -4,7 +4,13 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoord;
 //layout(location=2) in vec3 vColor;
-uniform mat4 viewMat, projMat, modelMat; 
+// written once per frame, as late as possible, see cameraBuffer.h
+layout(std140) uniform Camera {
+	mat4 viewMat;
+	mat4 projMat;
+	vec3 camPos;
+};
+uniform mat4 modelMat;
 out vec3 fNormal;
 out vec3 fPosition;
 out vec2 fTexCoord;
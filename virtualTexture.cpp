@@ -0,0 +1,403 @@
+#include "virtualTexture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const int kMaxRequestsPerFrame = 64;
+const int kMaxUploadsPerFrame = 16;
+
+} // namespace
+
+bool VirtualTexture::open(const std::string &filename, int cacheSlots)
+{
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file.read(reinterpret_cast<char *>(&m_header), sizeof(m_header)) || std::memcmp(m_header.magic, "VTX1", 4) != 0) {
+        std::cerr << "ERROR: " << filename << " is not a virtual texture" << std::endl;
+        return false;
+    }
+    m_filename = filename;
+    m_pageTexels = static_cast<int>(m_header.pageSize + 2 * m_header.border);
+    const int coarsestPages = pagesAt(m_header.numLevels - 1, false) * pagesAt(m_header.numLevels - 1, true);
+    m_cacheSlots = std::max(cacheSlots, static_cast<int>(std::ceil(std::sqrt(coarsestPages + 1.0))));
+    m_slots.assign(m_cacheSlots * m_cacheSlots, Slot());
+
+    // physical page cache
+    const int cacheTexels = m_cacheSlots * m_pageTexels;
+    glGenTextures(1, &m_cacheTex);
+    glBindTexture(GL_TEXTURE_2D, m_cacheTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, cacheTexels, cacheTexels, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+
+    // indirection table, one mip level per pyramid level
+    m_indirection.resize(m_header.numLevels);
+    m_dirtyLevels.assign(m_header.numLevels, true);
+    glGenTextures(1, &m_indirectionTex);
+    glBindTexture(GL_TEXTURE_2D, m_indirectionTex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_header.numLevels - 1);
+    for (uint32_t level = 0; level < m_header.numLevels; level++) {
+        m_indirection[level].assign(pagesAt(level, false) * pagesAt(level, true) * 4, 0);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8UI, pagesAt(level, false), pagesAt(level, true), 0,
+                     GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // the coarsest level is loaded right away and never evicted
+    const int last = m_header.numLevels - 1;
+    std::vector<unsigned char> texels(pageBytes());
+    for (int y = 0; y < pagesAt(last, true); y++) {
+        for (int x = 0; x < pagesAt(last, false); x++) {
+            file.seekg(pageOffset(last, x, y));
+            file.read(reinterpret_cast<char *>(texels.data()), texels.size());
+            upload(last, x, y, texels.data(), 0);
+            m_slots[findSlot(last, x, y)].pinned = true;
+        }
+    }
+    flushIndirection();
+    std::cout << "virtual texture " << filename << ": " << m_header.pagesX * m_header.pageSize << "x" << m_header.pagesY * m_header.pageSize
+              << ", " << m_header.numLevels << " levels, cache of " << m_cacheSlots * m_cacheSlots << " pages" << std::endl;
+    return true;
+}
+
+void VirtualTexture::bind(GLuint program, int cacheUnit, int indirectionUnit, int id, float lodBias) const
+{
+    glActiveTexture(GL_TEXTURE0 + cacheUnit);
+    glBindTexture(GL_TEXTURE_2D, m_cacheTex);
+    glActiveTexture(GL_TEXTURE0 + indirectionUnit);
+    glBindTexture(GL_TEXTURE_2D, m_indirectionTex);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(program, "vtCache"), cacheUnit);
+    glUniform1i(glGetUniformLocation(program, "vtIndirection"), indirectionUnit);
+    glUniform2i(glGetUniformLocation(program, "vtPages"), m_header.pagesX, m_header.pagesY);
+    glUniform1i(glGetUniformLocation(program, "vtNumLevels"), m_header.numLevels);
+    glUniform1i(glGetUniformLocation(program, "vtPageSize"), m_header.pageSize);
+    glUniform1i(glGetUniformLocation(program, "vtBorder"), m_header.border);
+    glUniform1f(glGetUniformLocation(program, "vtCacheSize"), static_cast<float>(m_cacheSlots * m_pageTexels));
+    glUniform1f(glGetUniformLocation(program, "vtLodBias"), lodBias);
+    glUniform1i(glGetUniformLocation(program, "vtId"), id);
+}
+
+size_t VirtualTexture::pageOffset(int level, int x, int y) const
+{
+    size_t pageIndex = 0;
+    for (int l = 0; l < level; l++)
+        pageIndex += static_cast<size_t>(pagesAt(l, false)) * pagesAt(l, true);
+    pageIndex += static_cast<size_t>(y) * pagesAt(level, false) + x;
+    return sizeof(VirtualTextureHeader) + pageIndex * pageBytes();
+}
+
+int VirtualTexture::findSlot(int level, int x, int y) const
+{
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        if (m_slots[i].level == level && m_slots[i].x == x && m_slots[i].y == y)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+bool VirtualTexture::isResident(int level, int x, int y) const
+{
+    // the indirection entry of a resident page points to that very page
+    const uint8_t *e = &m_indirection[level][(y * pagesAt(level, false) + x) * 4];
+    return e[3] != 0 && e[2] == level;
+}
+
+void VirtualTexture::touch(int level, int x, int y, uint64_t frame)
+{
+    if (!isResident(level, x, y))
+        return;
+    const uint8_t *e = &m_indirection[level][(y * pagesAt(level, false) + x) * 4];
+    m_slots[e[1] * m_cacheSlots + e[0]].lastUsedFrame = frame;
+}
+
+// Points the entries covered by page (level, x, y) to its slot, on this level and the finer
+// ones, unless they already map to a finer page.
+void VirtualTexture::mapRegion(int level, int x, int y, int slot)
+{
+    for (int l = level; l >= 0; l--) {
+        const int shift = level - l;
+        const int width = pagesAt(l, false);
+        for (int py = y << shift; py < (y + 1) << shift; py++) {
+            for (int px = x << shift; px < (x + 1) << shift; px++) {
+                uint8_t *e = &m_indirection[l][(py * width + px) * 4];
+                if (e[3] != 0 && e[2] < level)
+                    continue;
+                e[0] = static_cast<uint8_t>(slot % m_cacheSlots);
+                e[1] = static_cast<uint8_t>(slot / m_cacheSlots);
+                e[2] = static_cast<uint8_t>(level);
+                e[3] = 1;
+            }
+        }
+        m_dirtyLevels[l] = true;
+    }
+}
+
+// The entries that pointed to page (level, x, y) fall back to its parent's mapping.
+void VirtualTexture::unmapRegion(int level, int x, int y)
+{
+    const uint8_t *parent = &m_indirection[level + 1][((y >> 1) * pagesAt(level + 1, false) + (x >> 1)) * 4];
+    uint8_t fallback[4];
+    std::memcpy(fallback, parent, 4);
+    for (int l = level; l >= 0; l--) {
+        const int shift = level - l;
+        const int width = pagesAt(l, false);
+        for (int py = y << shift; py < (y + 1) << shift; py++) {
+            for (int px = x << shift; px < (x + 1) << shift; px++) {
+                uint8_t *e = &m_indirection[l][(py * width + px) * 4];
+                if (e[2] == level)
+                    std::memcpy(e, fallback, 4);
+            }
+        }
+        m_dirtyLevels[l] = true;
+    }
+}
+
+bool VirtualTexture::upload(int level, int x, int y, const unsigned char *texels, uint64_t frame)
+{
+    int slot = -1;
+    for (size_t i = 0; i < m_slots.size(); i++) {
+        const Slot &s = m_slots[i];
+        if (s.level < 0) { slot = static_cast<int>(i); break; }
+        if (s.pinned || (frame > 0 && s.lastUsedFrame >= frame))
+            continue;
+        if (slot < 0 || s.lastUsedFrame < m_slots[slot].lastUsedFrame)
+            slot = static_cast<int>(i);
+    }
+    if (slot < 0)
+        return false;
+    Slot &s = m_slots[slot];
+    if (s.level >= 0)
+        unmapRegion(s.level, s.x, s.y);
+    s.level = level;
+    s.x = x;
+    s.y = y;
+    s.lastUsedFrame = frame;
+
+    glBindTexture(GL_TEXTURE_2D, m_cacheTex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % m_cacheSlots) * m_pageTexels, (slot / m_cacheSlots) * m_pageTexels,
+                    m_pageTexels, m_pageTexels, GL_RGB, GL_UNSIGNED_BYTE, texels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    mapRegion(level, x, y, slot);
+    return true;
+}
+
+void VirtualTexture::flushIndirection()
+{
+    glBindTexture(GL_TEXTURE_2D, m_indirectionTex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (uint32_t level = 0; level < m_header.numLevels; level++) {
+        if (!m_dirtyLevels[level])
+            continue;
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, pagesAt(level, false), pagesAt(level, true),
+                        GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, m_indirection[level].data());
+        m_dirtyLevels[level] = false;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void VirtualTexture::clear()
+{
+    if (m_cacheTex != 0)
+        glDeleteTextures(1, &m_cacheTex);
+    if (m_indirectionTex != 0)
+        glDeleteTextures(1, &m_indirectionTex);
+    m_cacheTex = m_indirectionTex = 0;
+}
+
+VirtualTextureSystem::~VirtualTextureSystem()
+{
+    stopLoader(); // the GL objects went with clear()
+}
+
+void VirtualTextureSystem::stopLoader()
+{
+    if (!m_loader.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    m_loader.join();
+    m_quit = false;
+    m_queue.clear();
+    m_loaded.clear();
+    m_inFlight.clear();
+}
+
+void VirtualTextureSystem::clear()
+{
+    stopLoader();
+    for (std::unique_ptr<VirtualTexture> &vt : m_textures)
+        vt->clear();
+    m_textures.clear();
+    if (m_fbo != 0) {
+        glDeleteFramebuffers(1, &m_fbo);
+        glDeleteRenderbuffers(1, &m_colorRb);
+        glDeleteRenderbuffers(1, &m_depthRb);
+        glDeleteBuffers(1, &m_pbo);
+    }
+    m_fbo = m_colorRb = m_depthRb = m_pbo = 0;
+    m_pendingReadback = false;
+}
+
+int VirtualTextureSystem::add(std::unique_ptr<VirtualTexture> vt)
+{
+    {
+        // the loader thread looks textures up by index
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_textures.push_back(std::move(vt));
+    }
+    if (!m_loader.joinable())
+        m_loader = std::thread(&VirtualTextureSystem::loaderLoop, this);
+    return static_cast<int>(m_textures.size()) - 1;
+}
+
+void VirtualTextureSystem::resize(int screenWidth, int screenHeight, int feedbackDivisor)
+{
+    m_divisor = feedbackDivisor;
+    m_width = std::max(1, screenWidth / feedbackDivisor);
+    m_height = std::max(1, screenHeight / feedbackDivisor);
+    if (m_fbo == 0) {
+        glGenFramebuffers(1, &m_fbo);
+        glGenRenderbuffers(1, &m_colorRb);
+        glGenRenderbuffers(1, &m_depthRb);
+        glGenBuffers(1, &m_pbo);
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colorRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, m_width, m_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, m_width, m_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorRb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthRb);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, m_width * m_height * 4 * sizeof(GLushort), nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_pendingReadback = false;
+}
+
+void VirtualTextureSystem::beginFeedback()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glViewport(0, 0, m_width, m_height);
+    const GLuint clearValue[4] = {0, 0, 0, 0};
+    glClearBufferuiv(GL_COLOR, 0, clearValue);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTextureSystem::endFeedback(int screenWidth, int screenHeight)
+{
+    // asynchronous read back, mapped one frame later
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, screenWidth, screenHeight);
+    m_pendingReadback = true;
+}
+
+void VirtualTextureSystem::update(uint64_t frame)
+{
+    // 1. pages needed by the last feedback pass
+    if (m_pendingReadback) {
+        std::set<PageRequest> needed;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbo);
+        const GLushort *texels = static_cast<const GLushort *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, m_width * m_height * 4 * sizeof(GLushort), GL_MAP_READ_BIT));
+        if (texels != nullptr) {
+            for (int i = 0; i < m_width * m_height; i++) {
+                const GLushort *t = texels + 4 * i;
+                if (t[3] == 0 || t[3] > m_textures.size())
+                    continue;
+                needed.insert(PageRequest{t[3] - 1, t[2], t[0], t[1]});
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        m_pendingReadback = false;
+
+        int requested = 0;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const PageRequest &r : needed) {
+            VirtualTexture *vt = m_textures[r.vt].get();
+            if (r.level >= static_cast<int>(vt->getHeader().numLevels) || r.x >= vt->pagesAt(r.level, false) || r.y >= vt->pagesAt(r.level, true))
+                continue;
+            if (vt->isResident(r.level, r.x, r.y)) {
+                vt->touch(r.level, r.x, r.y, frame);
+            }
+            else if (requested < kMaxRequestsPerFrame && m_inFlight.insert(r).second) {
+                m_queue.push_back(r);
+                requested++;
+            }
+        }
+        if (requested > 0)
+            m_cond.notify_one();
+    }
+
+    // 2. upload what the loader thread has read
+    std::vector<LoadedPage> loaded;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const size_t n = std::min(m_loaded.size(), static_cast<size_t>(kMaxUploadsPerFrame));
+        loaded.assign(std::make_move_iterator(m_loaded.begin()), std::make_move_iterator(m_loaded.begin() + n));
+        m_loaded.erase(m_loaded.begin(), m_loaded.begin() + n);
+        for (const LoadedPage &p : loaded)
+            m_inFlight.erase(p.request);
+    }
+    for (const LoadedPage &p : loaded) {
+        VirtualTexture *vt = m_textures[p.request.vt].get();
+        if (!p.texels.empty())
+            vt->upload(p.request.level, p.request.x, p.request.y, p.texels.data(), frame);
+    }
+    for (auto &vt : m_textures)
+        vt->flushIndirection();
+}
+
+void VirtualTextureSystem::loaderLoop()
+{
+    std::vector<std::unique_ptr<std::ifstream>> files;
+    while (true) {
+        PageRequest r;
+        VirtualTexture *vt;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+            if (m_quit)
+                return;
+            r = m_queue.front();
+            m_queue.pop_front();
+            vt = m_textures[r.vt].get(); // add() may grow m_textures meanwhile, the textures themselves stay
+        }
+        if (files.size() <= static_cast<size_t>(r.vt))
+            files.resize(r.vt + 1);
+        if (!files[r.vt])
+            files[r.vt].reset(new std::ifstream(vt->getFilename().c_str(), std::ios::binary));
+
+        LoadedPage page;
+        page.request = r;
+        page.texels.resize(vt->pageBytes());
+        std::ifstream &file = *files[r.vt];
+        file.clear();
+        file.seekg(vt->pageOffset(r.level, r.x, r.y));
+        if (!file.read(reinterpret_cast<char *>(page.texels.data()), page.texels.size()))
+            page.texels.clear();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_loaded.push_back(std::move(page));
+    }
+}
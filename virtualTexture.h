@@ -0,0 +1,139 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Tiled virtual texturing for maps too large to be resident (16K-64K Earth and sky).
+//
+// The vtTiler tool cuts a map into a mip pyramid of fixed-size pages stored in a single
+// .vt file. At runtime only the pages seen on screen live in a physical page cache
+// texture; an indirection texture (one texel per page, one mip per level) tells the
+// fragment shader in which cache slot a page is, or in which slot its closest resident
+// ancestor is. A low resolution feedback pass writes the page each pixel needs, it is
+// read back asynchronously, and the missing pages are loaded by a background thread.
+// Memory is driven by the screen resolution, not by the size of the maps.
+
+// Layout of a .vt file: this header, then the pages of level 0 in row-major order, then
+// those of level 1, etc. Every page is (pageSize + 2 * border)^2 RGB8 texels, the border
+// duplicating the neighbouring texels so that bilinear filtering works inside the cache.
+struct VirtualTextureHeader {
+    char magic[4];        // "VTX1"
+    uint32_t pageSize;
+    uint32_t border;
+    uint32_t pagesX;      // pages of level 0, powers of two
+    uint32_t pagesY;
+    uint32_t numLevels;   // the coarsest level is (pagesX, pagesY) >> (numLevels - 1)
+};
+
+class VirtualTexture {
+public:
+    // Opens a .vt file and creates its GPU resources, with a cache of cacheSlots^2 pages.
+    bool open(const std::string &filename, int cacheSlots = 16);
+
+    // Binds the cache and indirection textures on the given units and sets the vt* uniforms.
+    void bind(GLuint program, int cacheUnit, int indirectionUnit, int id, float lodBias) const;
+
+    inline const VirtualTextureHeader &getHeader() const { return m_header; }
+    inline const std::string &getFilename() const { return m_filename; }
+    inline int pageBytes() const { return m_pageTexels * m_pageTexels * 3; }
+    inline int pagesAt(int level, bool y) const {
+        return static_cast<int>((y ? m_header.pagesY : m_header.pagesX) >> level);
+    }
+    // Position of a page in the .vt file
+    size_t pageOffset(int level, int x, int y) const;
+    bool isResident(int level, int x, int y) const;
+    void touch(int level, int x, int y, uint64_t frame);
+    // Copies a loaded page into a cache slot, evicting the least recently used page.
+    // Returns false when every slot is in use this frame.
+    bool upload(int level, int x, int y, const unsigned char *texels, uint64_t frame);
+    // Sends the modified levels of the indirection table to the GPU.
+    void flushIndirection();
+    // Deletes the cache and indirection textures, while the context is current.
+    void clear();
+
+private:
+    struct Slot {
+        int level = -1, x = 0, y = 0; // page held, level -1 when free
+        uint64_t lastUsedFrame = 0;
+        bool pinned = false;          // pages of the coarsest level are always resident
+    };
+    int findSlot(int level, int x, int y) const;
+    void mapRegion(int level, int x, int y, int slot);
+    void unmapRegion(int level, int x, int y);
+
+    std::string m_filename;
+    VirtualTextureHeader m_header;
+    int m_pageTexels = 0;        // page size including its borders
+    int m_cacheSlots = 0;        // slots per side of the cache
+    GLuint m_cacheTex = 0;
+    GLuint m_indirectionTex = 0;
+    std::vector<Slot> m_slots;
+    std::vector<std::vector<uint8_t>> m_indirection; // RGBA8UI per level: slot x, slot y, mapped level, valid
+    std::vector<bool> m_dirtyLevels;
+};
+
+// Feedback pass, page streaming thread and cache updates for a set of virtual textures.
+class VirtualTextureSystem {
+public:
+    ~VirtualTextureSystem();
+
+    // Takes ownership; the index in the system is the id given to the shaders.
+    int add(std::unique_ptr<VirtualTexture> vt);
+    inline VirtualTexture *get(int id) { return m_textures[id].get(); }
+    inline bool empty() const { return m_textures.empty(); }
+
+    // Feedback render target, feedbackDivisor times smaller than the screen.
+    void resize(int screenWidth, int screenHeight, int feedbackDivisor = 8);
+    inline float getLodBias() const { return -std::log2(static_cast<float>(m_divisor)); }
+    // Wraps the feedback draws: render the virtually textured meshes in between.
+    void beginFeedback();
+    void endFeedback(int screenWidth, int screenHeight);
+    // Reads the previous feedback, queues the missing pages and uploads the loaded ones.
+    void update(uint64_t frame);
+    // Stops the loader and deletes the GL objects and the textures, while the context is current.
+    void clear();
+
+private:
+    struct PageRequest {
+        int vt, level, x, y;
+        bool operator<(const PageRequest &o) const {
+            if (vt != o.vt) return vt < o.vt;
+            if (level != o.level) return level > o.level; // coarse pages first
+            if (y != o.y) return y < o.y;
+            return x < o.x;
+        }
+    };
+    struct LoadedPage {
+        PageRequest request;
+        std::vector<unsigned char> texels;
+    };
+    void stopLoader();
+    void loaderLoop();
+
+    std::vector<std::unique_ptr<VirtualTexture>> m_textures;
+    GLuint m_fbo = 0, m_colorRb = 0, m_depthRb = 0;
+    GLuint m_pbo = 0;
+    int m_width = 0, m_height = 0, m_divisor = 8;
+    bool m_pendingReadback = false;
+
+    std::thread m_loader;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<PageRequest> m_queue;
+    std::vector<LoadedPage> m_loaded;
+    std::set<PageRequest> m_inFlight; // queued or loaded, not yet uploaded
+    bool m_quit = false;
+};
+
+#endif // VIRTUAL_TEXTURE_H